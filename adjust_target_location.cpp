@@ -25,6 +25,7 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <unistd.h>
 
 //------------------------------------------------------------------------------
 struct ShiftMatchData{
@@ -71,12 +72,18 @@ bool parse_record(std::string &line, TargetInfo &target, bool *isSubjectNotFound
     return true;
 }
 //------------------------------------------------------------------------------
-char * extract_seq(const char *ref, ChromosomeLocation &location, size_t *szQuery){
+template <typename Tgenome>
+char * extract_seq(Tgenome &ref, const std::string &chr, \
+        ChromosomeLocation &location, size_t *szQuery){
 
+    // only the target region is read (indexed FASTA) or decoded (2bit genome)
     *szQuery = std::abs(location.end - location.start + 1);
-    char *seq = new char [(*szQuery)+1];
-    std::memset(seq, '\0', (*szQuery)+1);
-    std::strncpy(seq, &ref[location.start], *szQuery);
+    // NULL when the chromosome isn't in the genome; never compare a blank buffer
+    char *seq = ref.fetch(chr, location.start, location.start + (*szQuery) - 1);
+    if(NULL == seq){
+        std::cerr << WARNING_STRING << "sequence not found. chr=" << chr \
+                << " start=" << location.start << " end=" << location.end << ENDL;
+    }
     return seq;
 }
 //------------------------------------------------------------------------------
@@ -98,46 +105,21 @@ bool is_match(const char *query, const size_t *szQuery, const char *subject, \
     return false;
 }
 //------------------------------------------------------------------------------
-int main(int argc, char *argv[]){
-size_t nArg=4;
-
-	if(argc<=nArg){
-		std::cerr << USAGE_STRING << argv[0] \
-                << " [input_tab] [old_seq] [new_seq] [output_fn]" << ENDL;
-		exit(EXIT_FAILURE);
-	}
-	const char *inFn=argv[1], *querySeqFn=argv[2];
-    const char *subjectSeqFn=argv[3], *outFn=argv[4];
-
-    // input file
-    std::ifstream infile(inFn, std::ios::in);
-    if(infile.fail()){
-        std::cerr << ERROR_STRING << __LINE__ << ENDL;
-        exit(EXIT_FAILURE);
-    }
-
-    // reference sequences
-    hi::CSeq query_seqobject;
-    if(RV_TRUE!=query_seqobject.open(querySeqFn)){
-        std::cerr << ERROR_STRING << __LINE__ << ENDL;
-        exit(EXIT_FAILURE);
-    }
-    hi::CSeq subject_seqobject;
-    if(RV_TRUE!=subject_seqobject.open(subjectSeqFn)){
-        std::cerr << ERROR_STRING << __LINE__ << ENDL;
-        exit(EXIT_FAILURE);
-    }
-
-    // output
-    std::ofstream outfile(outFn, std::ios::out);
-    if(outfile.fail()){
-        std::cerr << ERROR_STRING << __LINE__ << ENDL;
-        exit(EXIT_FAILURE);
-    }
+/**
+ * ターゲット領域の位置を新しいゲノム上の位置に補正する
+ * @param infile            ターゲット領域の一覧
+ * @param query_seqobject   旧ゲノム（hi::CSeqまたはhi::CPackedGenome）
+ * @param subject_seqobject 新ゲノム（同上）
+ * @param outfile           出力
+ * @param stats             実行統計（--stats指定時のみ記録される）
+ */
+template <typename Tgenome>
+void process_targets(std::istream &infile, Tgenome &query_seqobject, \
+        Tgenome &subject_seqobject, hi::OutputWriter &outfile, hi::RunStats &stats){
 
     const size_t maxShiftAllowed=5;
-    char *query_genome, *subject_genome, *query_seq, *subject_seq;
-    size_t szQueryGenome, szSubjectGenome, szQuery, szSubject;
+    char *query_seq, *subject_seq;
+    size_t szQuery, szSubject;
     int bestShift, diff;
 
     std::string line;
@@ -146,37 +128,38 @@ size_t nArg=4;
     TargetInfo target, last;
     ChromosomeLocation estimate;
 
+    stats.enter("record_parse");
     while(std::getline(infile, line)){
         isSubjectNotFound = false;
+        stats.count("records_in");
         if(! parse_record(line, target, &isSubjectNotFound)){
             std::cerr << WARNING_STRING \
                     << "parse_record() failed. line=" << line << ENDL;
+            stats.count("parse_errors");
             continue;
         }
+        stats.count("records_out");
 
-        if(target.query.chr!=last.query.chr){
-            if(! isFirst){
-                delete[] query_genome;
-                delete[] subject_genome;
-            }
-            query_genome = query_seqobject.read();
-            subject_genome = subject_seqobject.read();
+        if(target.query.chr!=last.query.chr)
             isFirst = true;
-        }
 
         // not found -- estimate from last record
         if(isSubjectNotFound){
             if(isFirst){
                 outfile << target << "\tNOT_FOUND" << ENDL;
+                stats.count("status.not_found");
                 continue;
             }
 
+            stats.enter("adjust");
             estimate = target.query;
             estimate.start += last.dist_start;
             estimate.end   += last.dist_end;
-            query_seq = extract_seq(query_genome, target.query, &szQuery);
-            subject_seq = extract_seq(subject_genome, estimate, &szSubject);
-            if(is_match(query_seq, &szQuery, subject_seq, &szSubject, &maxShiftAllowed, &bestShift)){
+            query_seq = extract_seq(query_seqobject, target.query.chr, target.query, &szQuery);
+            subject_seq = extract_seq(subject_seqobject, last.subject.chr, estimate, &szSubject);
+            if(NULL!=query_seq && NULL!=subject_seq \
+                    && is_match(query_seq, &szQuery, subject_seq, &szSubject, &maxShiftAllowed, &bestShift)){
+                target.subject.chr = last.subject.chr;
                 target.subject.start = \
                         std::min(estimate.start + bestShift-1, estimate.end + bestShift-1);
                 target.subject.end = \
@@ -184,15 +167,18 @@ size_t nArg=4;
                 target.dist_start = last.dist_start;
                 target.dist_end = last.dist_end;
                 outfile << target << "\tFILLED_FROM_LAST_SHIFT" << ENDL;
+                stats.count("status.filled_from_last_shift");
                 last = target;
             }
             else{
                 ChromosomeLocation empty_record;
                 target.subject = empty_record;
                 outfile << target << "\tNOT_FOUND" << ENDL;
+                stats.count("status.not_found");
             }
             delete[] subject_seq;
             delete[] query_seq;
+            stats.leave();
             continue;
         }
 
@@ -200,18 +186,21 @@ size_t nArg=4;
         diff = std::abs(target.dist_start - last.dist_start) + std::abs(target.dist_end - last.dist_end);
         if(0==diff || std::abs(last.query.length - last.subject.length)==diff || isFirst){
             outfile << target << ENDL;
+            stats.count("status.as_is");
             last = target;
             isFirst = false;
             continue;
         }
 
         // try estimated location from last dist_start/end if the diff is too big
+        stats.enter("adjust");
         estimate = target.query;
         estimate.start += last.dist_start;
         estimate.end   += last.dist_end;
-        query_seq = extract_seq(query_genome, target.query, &szQuery);
-        subject_seq = extract_seq(subject_genome, estimate, &szSubject);
-        if(is_match(query_seq, &szQuery, subject_seq, &szSubject, &maxShiftAllowed, &bestShift)){
+        query_seq = extract_seq(query_seqobject, target.query.chr, target.query, &szQuery);
+        subject_seq = extract_seq(subject_seqobject, target.subject.chr, estimate, &szSubject);
+        if(NULL!=query_seq && NULL!=subject_seq \
+                && is_match(query_seq, &szQuery, subject_seq, &szSubject, &maxShiftAllowed, &bestShift)){
             target.subject.start = \
                     std::min(estimate.start + bestShift-1, estimate.end + bestShift-1);
             target.subject.end = \
@@ -219,27 +208,126 @@ size_t nArg=4;
             target.dist_start = last.dist_start;
             target.dist_end   = last.dist_end;
             outfile << target << "\tADJUSTED_BY_LAST_SHIFT" << ENDL;
+            stats.count("status.adjusted_by_last_shift");
         }
         else{
             delete[] subject_seq;
-            subject_seq = extract_seq(subject_genome, target.subject, &szSubject);
-            if(is_match(query_seq, &szQuery, subject_seq, &szSubject, &maxShiftAllowed, &bestShift))
+            subject_seq = extract_seq(subject_seqobject, target.subject.chr, target.subject, &szSubject);
+            if(NULL!=query_seq && NULL!=subject_seq \
+                    && is_match(query_seq, &szQuery, subject_seq, &szSubject, &maxShiftAllowed, &bestShift)){
                 outfile << target << "\tADJUSTMENT_NOT_SUCCEED" << ENDL;
+                stats.count("status.adjustment_not_succeed");
+            }
             else{
                 ChromosomeLocation empty_record;
                 target.subject = empty_record;
                 outfile << target << "\tNOT_FOUND" << ENDL;
+                stats.count("status.not_found");
                 delete[] query_seq;
                 delete[] subject_seq;
+                stats.leave();
                 continue;
             }
         }
         last = target;
         delete[] query_seq;
         delete[] subject_seq;
+        stats.leave();
+    }
+    stats.leave();
+}
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[]){
+size_t nArg=4;
+
+	if(argc<=nArg){
+		std::cerr << USAGE_STRING << argv[0] \
+                << " (-p) (--stats[=json]) [input_tab] [old_seq] [new_seq] [output_fn]" << ENDL;
+        std::cerr << " -p       Load both genomes as 2bit packed sequences [FALSE]" << ENDL;
+        std::cerr << " --stats  Report phase timings and counters to stderr (text or json)" << ENDL;
+		exit(EXIT_FAILURE);
+	}
+
+    // parse arguments
+    char option;
+    bool use_packed_genome=false;
+    hi::RunStats stats;
+    static const struct option long_options[] = {STATS_LONG_OPTION, {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "p", long_options, NULL)) != -1){
+        switch (option){
+            case 'p':
+                use_packed_genome = true;
+                break;
+            case 'S':
+                stats.enable(optarg);
+                break;
+        }
+    }
+    if(argc-optind < nArg){
+        std::cerr << USAGE_STRING << argv[0] \
+                << " (-p) (--stats[=json]) [input_tab] [old_seq] [new_seq] [output_fn]" << ENDL;
+        exit(EXIT_FAILURE);
+    }
+	const char *inFn=argv[optind], *querySeqFn=argv[optind+1];
+    const char *subjectSeqFn=argv[optind+2], *outFn=argv[optind+3];
+
+    // input file
+    hi::InputStream infile(inFn);
+    if(infile.fail()){
+        std::cerr << ERROR_STRING << __LINE__ << ENDL;
+        exit(EXIT_FAILURE);
     }
+
+    // output
+    hi::OutputWriter outfile(outFn);
+    if(outfile.fail()){
+        std::cerr << ERROR_STRING << __LINE__ << ENDL;
+        exit(EXIT_FAILURE);
+    }
+
+    // reference sequences
+    // chromosomes are looked up by name, so the target table doesn't need
+    // to be sorted in the same order as the genomes
+    if(use_packed_genome){
+        // whole genomes in memory at 2 bits per base
+        hi::CPackedGenome query_seqobject, subject_seqobject;
+        stats.enter("genome_load");
+        if(RV_TRUE!=query_seqobject.load(querySeqFn) \
+                || RV_TRUE!=subject_seqobject.load(subjectSeqFn)){
+            std::cerr << ERROR_STRING << __LINE__ << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        stats.leave();
+        process_targets(infile, query_seqobject, subject_seqobject, outfile, stats);
+    }
+    else{
+        // only the target regions are read from the indexed FASTA files
+        stats.enter("genome_load");
+        hi::CSeq query_seqobject;
+        if(RV_TRUE!=query_seqobject.open(querySeqFn) || RV_TRUE!=query_seqobject.index()){
+            std::cerr << ERROR_STRING << __LINE__ << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        hi::CSeq subject_seqobject;
+        if(RV_TRUE!=subject_seqobject.open(subjectSeqFn) || RV_TRUE!=subject_seqobject.index()){
+            std::cerr << ERROR_STRING << __LINE__ << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        stats.leave();
+        process_targets(infile, query_seqobject, subject_seqobject, outfile, stats);
+    }
+
     infile.close();
-    outfile.close();
+    stats.enter("output");
+    if(! outfile.close()){
+        std::cerr << ERROR_STRING << "the output file (" << outFn \
+                << ") can't write. Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    stats.leave();
+    stats.count("bytes_read", infile.bytes_read());
+    stats.count("bytes_written", outfile.bytes_written());
+    stats.report("adjust_target_location");
 
 	exit(EXIT_SUCCESS);
 }
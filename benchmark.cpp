@@ -0,0 +1,709 @@
+/**
+ * Copyright (c) 2018 Hiroyuki Ichida. All rights reserved.
+ *
+ * @file benchmark.cpp
+ * @author Hiroyuki Ichida <histfd@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 (GPL-2.0)
+ * as published by the Free Software Foundation, Inc.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "histd.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define DEFAULT_BINDIR      "bin"
+#define DEFAULT_DATADIR     "bench_data"
+#define DEFAULT_SCALES      "2000,20000,100000"
+#define DEFAULT_SAMPLES     24
+#define DEFAULT_REPEATS     3
+#define DEFAULT_TOLERANCE   0.2
+#define NUM_CHROMOSOMES     12
+#define NUM_GENOME_CHRS     3
+#define STAMP_FN            "stamp"
+#define BASES               "ACGT"
+
+//------------------------------------------------------------------------------
+/**
+ * 再現性のある乱数（xorshift64*）
+ * 同じseedからは環境によらず同じデータを生成する
+ */
+class CRandom{
+public:
+    uint64_t next(void){
+        this->State ^= this->State >> 12;
+        this->State ^= this->State << 25;
+        this->State ^= this->State >> 27;
+        return this->State * 2685821657736338717ULL;
+    }
+    // [low, high]
+    long range(long low, long high){
+        return low + (long)(this->next() % (uint64_t)(high - low + 1));
+    }
+    // [0, 1)
+    double uniform(void){
+        return (this->next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    char base(void){
+        return BASES[this->next() & 3];
+    }
+    CRandom(uint64_t seed){
+        this->State = seed * 0x9E3779B97F4A7C15ULL + 1;
+    }
+
+private:
+    uint64_t State;
+};
+
+//------------------------------------------------------------------------------
+struct BenchResult{
+    std::string tool;
+    long scale, records, bytes, peak_rss;
+    double seconds;
+};
+typedef std::vector<BenchResult> BenchResultArray;
+
+//------------------------------------------------------------------------------
+inline std::string chr_name(const char *prefix, int chr){
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%s%02d", prefix, chr);
+    return buf;
+}
+//------------------------------------------------------------------------------
+inline void close_dataset_file(hi::OutputWriter &ofs, const std::string &fn){
+    if(! ofs.close()){
+        std::cerr << ERROR_STRING << "the dataset file (" << fn \
+                << ") can't write. Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+}
+//------------------------------------------------------------------------------
+/**
+ * pindel/GATK形式の混在した多検体VCFを作る
+ * @param fn         出力ファイル名
+ * @param rnd        乱数
+ * @param nRecords   レコード数
+ * @param nSamples   検体数
+ */
+void generate_vcf(const std::string &fn, CRandom &rnd, long nRecords, int nSamples){
+
+    hi::OutputWriter ofs(fn.c_str());
+    ofs << "##fileformat=VCFv4.1" << ENDL << "##source=benchmark" << ENDL;
+    ofs << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+    for(int i=0; i<nSamples; ++i)
+        ofs << '\t' << chr_name("L0", i);
+    ofs << ENDL;
+
+    static const char *effects[] = {"missense_variant", "synonymous_variant", \
+            "frameshift_variant", "intron_variant"};
+    std::string ref, alt, gene, gt, ad;
+    long pos=1000;
+    int chr, nAlt, mut, mut2;
+    int depth[3];
+    char buf[64];
+    for(long r=0; r<nRecords; ++r){
+        chr = 1 + r * NUM_CHROMOSOMES / nRecords;
+        pos += rnd.range(1, 500);
+
+        // REF/ALT: SNV, deletion, insertion or two alternative alleles
+        const double type = rnd.uniform();
+        ref.assign(1, rnd.base());
+        nAlt = 1;
+        if(0.5 > type){
+            do{ alt.assign(1, rnd.base()); }while(alt == ref);
+        }
+        else if(0.7 > type){
+            for(long i=rnd.range(1, 130); i>0; --i)
+                ref.push_back(rnd.base());
+            alt.assign(1, ref[0]);
+        }
+        else if(0.85 > type){
+            alt = ref;
+            for(long i=rnd.range(1, 8); i>0; --i)
+                alt.push_back(rnd.base());
+        }
+        else{
+            const char *alts = ('A'==ref[0]) ? "CG" : ('C'==ref[0]) ? "GT" : ('G'==ref[0]) ? "TA" : "AC";
+            alt.assign(1, alts[0]);
+            alt.push_back(',');
+            alt.push_back(alts[1]);
+            nAlt = 2;
+        }
+
+        std::snprintf(buf, sizeof(buf), "%.2f", 10.0 + rnd.uniform() * 989.0);
+        ofs << chr_name("chr", chr) << '\t' << pos << "\t.\t" << ref << '\t' << alt \
+                << '\t' << buf << '\t' << (0.5 > rnd.uniform() ? "PASS" : ".") << '\t';
+
+        // INFO
+        if(0.05 > rnd.uniform())
+            ofs << '.';
+        else{
+            if(0.3 > rnd.uniform()){
+                ofs << "END=" << pos + (long)ref.length() \
+                        << ";SVLEN=" << (1==nAlt ? (long)alt.length() - (long)ref.length() : 0L) \
+                        << ";SVTYPE=" << (ref.length() > alt.length() ? "DEL" : "INS");
+            }
+            else
+                ofs << "AC=2;DP=" << rnd.range(10, 500);
+            if(0.8 > rnd.uniform()){
+                gene = chr_name("LOC_Os", chr);
+                std::snprintf(buf, sizeof(buf), "g%05ld", rnd.range(1, 9999) * 10);
+                gene += buf;
+                ofs << ";ANN=";
+                for(long k=rnd.range(1, 3); k>0; --k){
+                    ofs << alt.substr(0, 1) << '|' << effects[rnd.next() & 3] \
+                            << "|MODERATE|" << gene << '|' << gene << "|transcript" \
+                            << (1<k ? "," : "");
+                }
+                if(0.3 > rnd.uniform())
+                    ofs << ";LOF=(" << gene << "|1|0.5)";
+            }
+        }
+
+        // FORMAT & samples
+        const bool isPindel = (0.3 > rnd.uniform());
+        ofs << '\t' << (isPindel ? "GT:AD" : "GT:DP:AD");
+        mut = rnd.range(0, nSamples-1);
+        mut2 = (0.2 > rnd.uniform()) ? rnd.range(0, nSamples-1) : -1;
+        const bool isCommon = (0.1 > rnd.uniform());
+        for(int i=0; i<nSamples; ++i){
+            if(isCommon && 0.5 > rnd.uniform())
+                gt = "1/1";
+            else if(i == mut)
+                gt = (1==nAlt) ? (0.3 > rnd.uniform() ? "0/1" : "1/1") \
+                        : (0.5 > rnd.uniform() ? "2/2" : "1/2");
+            else if(i == mut2)
+                gt = (0.5 > rnd.uniform()) ? "0/1" : "1/1";
+            else if(0.03 > rnd.uniform())
+                gt = "./.";
+            else if(0.01 > rnd.uniform())
+                gt = "1/.";
+            else
+                gt = "0/0";
+
+            int dp=0;
+            if("./." == gt)
+                ad = "0,0";
+            else{
+                for(int k=0; k<=nAlt; ++k)
+                    depth[k] = rnd.range(0, 60);
+                if("0/0" == gt){
+                    depth[0] = rnd.range(5, 80);
+                    for(int k=1; k<=nAlt; ++k)
+                        depth[k] = (0.2 > rnd.uniform()) ? rnd.range(1, 3) : 0;
+                }
+                else if("1/1" == gt){
+                    depth[0] = rnd.range(0, 1);
+                    depth[1] = rnd.range(5, 80);
+                    if(2==nAlt)
+                        depth[2] = 0;
+                }
+                ad.clear();
+                for(int k=0; k<=nAlt; ++k){
+                    std::snprintf(buf, sizeof(buf), (0==k) ? "%d" : ",%d", depth[k]);
+                    ad += buf;
+                    dp += depth[k];
+                }
+                // pindel reports a single depth for homozygous genotypes
+                if(isPindel && ("0/0"==gt || "1/1"==gt || "1/."==gt)){
+                    std::snprintf(buf, sizeof(buf), "%d", ("0/0"==gt) ? depth[0] : depth[1]);
+                    ad = buf;
+                }
+            }
+            if(isPindel)
+                ofs << '\t' << gt << ':' << ad;
+            else
+                ofs << '\t' << gt << ':' << dp << ':' << ad;
+        }
+        ofs << ENDL;
+    }
+    close_dataset_file(ofs, fn);
+}
+//------------------------------------------------------------------------------
+void generate_gff(const std::string &fn, CRandom &rnd){
+
+    hi::OutputWriter ofs(fn.c_str());
+    ofs << "##gff-version 3" << ENDL;
+    char gid[32];
+    for(int chr=1; chr<=NUM_CHROMOSOMES; ++chr){
+        for(long k=0; k<100000; k+=10){
+            if(0.05 <= rnd.uniform())
+                continue;
+            std::snprintf(gid, sizeof(gid), "Os%02dg%05ld", chr, k);
+            ofs << chr_name("chr", chr) << "\tMSU\tgene\t" << k*10 << '\t' << k*10+500 \
+                    << "\t.\t+\t.\tID=" << gid << ";Name=" << gid;
+            if(0.5 > rnd.uniform())
+                ofs << ";Note=protein kinase " << k;
+            ofs << ENDL;
+            ofs << chr_name("chr", chr) << "\tMSU\tmRNA\t" << k*10 << '\t' << k*10+500 \
+                    << "\t.\t+\t.\tID=" << gid << ".1" << ENDL;
+        }
+    }
+    close_dataset_file(ofs, fn);
+}
+//------------------------------------------------------------------------------
+/**
+ * bedtools coverageの出力（.fracカラム）を模した表を作る
+ */
+void generate_coverage(const std::string &fn, CRandom &rnd, long nRecords, int nSamples){
+
+    hi::OutputWriter ofs(fn.c_str());
+    ofs << "##bedtools coverage" << ENDL << "#CHROM\tChrStart\tChrEnd\tName";
+    for(int i=0; i<nSamples; ++i)
+        ofs << '\t' << chr_name("L0", i) << ".frac";
+    ofs << ENDL;
+
+    hi::StringArray fracs(nSamples);
+    char buf[32];
+    long pos=100;
+    for(long r=0; r<nRecords; ++r){
+        pos += rnd.range(50, 400);
+        std::fill(fracs.begin(), fracs.end(), "1.0000");
+        const double type = rnd.uniform();
+        if(0.6 > type){
+            std::snprintf(buf, sizeof(buf), "%.4f", rnd.uniform() * 0.9);
+            fracs[rnd.range(0, nSamples-1)] = buf;
+            if(0.4 <= type)
+                fracs[rnd.range(0, nSamples-1)] = "0.5000";
+        }
+        else if(0.7 > type)
+            fracs[rnd.range(0, nSamples-1)] = "0.9999999999999";
+
+        // some regions appear twice in a row
+        for(int rep=(0.1 > rnd.uniform() ? 2 : 1); rep>0; --rep){
+            ofs << chr_name("chr", 1 + r * NUM_CHROMOSOMES / nRecords) << '\t' \
+                    << pos << '\t' << pos+200 << "\tt" << r;
+            for(int i=0; i<nSamples; ++i)
+                ofs << '\t' << fracs[i];
+            ofs << ENDL;
+        }
+    }
+    close_dataset_file(ofs, fn);
+}
+//------------------------------------------------------------------------------
+inline void write_fasta(hi::OutputWriter &ofs, const std::string &title, const std::string &seq){
+    ofs << '>' << title << " benchmark" << ENDL;
+    for(std::size_t i=0; i<seq.length(); i+=60)
+        ofs.write(seq.data()+i, std::min<std::size_t>(60, seq.length()-i)) << ENDL;
+}
+//------------------------------------------------------------------------------
+/**
+ * 旧/新ゲノムの組とターゲット表を作る
+ * 新ゲノムは旧ゲノムに小さな挿入・欠失を加えたもの
+ */
+void generate_genomes(const std::string &dir, CRandom &rnd, long nTargets){
+
+    const long nPerChr = std::max(1L, nTargets / NUM_GENOME_CHRS);
+    const long szChr = std::max(200000L, nPerChr * 1000 + 10000);
+    hi::OutputWriter old_fa((dir + "/old.fa").c_str());
+    hi::OutputWriter new_fa((dir + "/new.fa").c_str());
+    hi::OutputWriter targets((dir + "/targets.txt").c_str());
+
+    std::string seq, newseq;
+    for(int chr=1; chr<=NUM_GENOME_CHRS; ++chr){
+        seq.resize(szChr);
+        for(long i=0; i<szChr; ++i)
+            seq[i] = rnd.base();
+        seq.replace(5000, 12, "acgtacgtnnnn");
+
+        // indels at sorted random points
+        const long nIndels = 20 + szChr / 50000;
+        hi::IntArray points;
+        for(long i=0; i<nIndels; ++i)
+            points.push_back(rnd.range(1000, szChr-1000));
+        std::sort(points.begin(), points.end());
+        newseq.clear();
+        long last=0, delta;
+        for(std::size_t i=0; i<points.size(); ++i){
+            if(points[i] < last)
+                continue;
+            newseq.append(seq, last, points[i]-last);
+            delta = rnd.range(-3, 3);
+            last = points[i];
+            if(0 < delta)
+                newseq.append(delta, 'A');
+            else
+                last -= delta;
+        }
+        newseq.append(seq, last, std::string::npos);
+
+        write_fasta(old_fa, chr_name("chr", chr), seq);
+        write_fasta(new_fa, chr_name("Chr", chr), newseq);
+
+        // targets: some are missing in the new genome, others are shifted
+        static const int shifts[] = {0, 0, 1, -1, 2, 5, 40};
+        long pos=1000, length, ds, de;
+        for(long r=0; r<nPerChr && pos+1500<szChr; ++r){
+            pos += rnd.range(200, 1200);
+            if(pos+300 >= szChr)
+                break;
+            length = rnd.range(100, 300);
+            targets << chr_name("chr", chr) << '\t' << pos << '\t' << pos+length << '\t' << length+1;
+            if(0.15 > rnd.uniform()){
+                targets << "\tNOT FOUND" << ENDL;
+                continue;
+            }
+            ds = shifts[rnd.range(0, 6)];
+            de = ds + rnd.range(0, 1);
+            targets << '\t' << chr_name("Chr", chr) << '\t' << pos+ds << '\t' << pos+length+de \
+                    << '\t' << length+1+de-ds << '\t' << ds << '\t' << de << "\t100.0" << ENDL;
+        }
+    }
+    new_fa << ">Sy unplaced" << ENDL;
+    for(int i=0; i<100; ++i)
+        new_fa << "ACGTN";
+    new_fa << ENDL;
+
+    close_dataset_file(old_fa, dir + "/old.fa");
+    close_dataset_file(new_fa, dir + "/new.fa");
+    close_dataset_file(targets, dir + "/targets.txt");
+}
+//------------------------------------------------------------------------------
+/**
+ * 指定した規模のデータセットを用意する（作成済みなら再利用する）
+ * @return データセットのディレクトリ
+ */
+std::string prepare_dataset(const std::string &datadir, long scale, int nSamples){
+
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "/n%ld_s%d", scale, nSamples);
+    const std::string dir = datadir + buf;
+    struct stat st;
+    if(0 == stat((dir + "/" STAMP_FN).c_str(), &st))
+        return dir;
+
+    mkdir(datadir.c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    std::cerr << INFO_STRING << "generating the dataset in " << dir << ENDL;
+
+    // each file has its own seed, so that the contents don't depend on each other
+    CRandom rnd_vcf(scale * 4 + 1), rnd_gff(7), rnd_cov(scale * 4 + 2), rnd_fa(scale * 4 + 3);
+    generate_vcf(dir + "/in.vcf", rnd_vcf, scale, nSamples);
+    generate_gff(dir + "/in.gff", rnd_gff);
+    generate_coverage(dir + "/cov.txt", rnd_cov, scale, nSamples);
+    generate_genomes(dir, rnd_fa, std::max(30L, scale / 4));
+
+    std::ofstream stamp((dir + "/" STAMP_FN).c_str());
+    stamp << "ok" << ENDL;
+    return dir;
+}
+//------------------------------------------------------------------------------
+/**
+ * データ行（'#'で始まらない行）の数とファイルサイズを数える
+ */
+long count_records(const std::string &fn, long *bytes){
+
+    hi::MappedFile file;
+    *bytes = 0;
+    if(! file.open(fn.c_str()))
+        return 0;
+    *bytes = file.size();
+
+    long count=0;
+    const char *head = file.data(), *tail = file.data() + file.size(), *eol;
+    while(head < tail){
+        eol = static_cast<const char *>(std::memchr(head, '\n', tail-head));
+        if('#' != *head)
+            ++count;
+        head = (NULL == eol) ? tail : eol+1;
+    }
+    return count;
+}
+//------------------------------------------------------------------------------
+/**
+ * ツールを子プロセスとして実行し，経過時間と最大RSSを測る
+ * @param args     コマンドライン（args[0]が実行ファイル）
+ * @param out_fn   標準出力の保存先
+ * @param seconds  経過時間（秒）
+ * @param peak_rss 最大RSS（KB）
+ * @return 正常終了したか否か
+ */
+bool run_tool(const hi::StringArray &args, const std::string &out_fn, \
+        double *seconds, long *peak_rss){
+
+    std::vector<char *> argv;
+    for(std::size_t i=0; i<args.size(); ++i)
+        argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(NULL);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if(0 > pid)
+        return false;
+    if(0 == pid){
+        int fd = ::open(out_fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int devnull = ::open("/dev/null", O_WRONLY);
+        if(0 > fd || 0 > devnull)
+            _exit(127);
+        dup2(fd, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if(pid != wait4(pid, &status, 0, &usage))
+        return false;
+    *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    *peak_rss = usage.ru_maxrss;
+    return WIFEXITED(status) && EXIT_SUCCESS == WEXITSTATUS(status);
+}
+//------------------------------------------------------------------------------
+/**
+ * 1つのツールを繰り返し実行して最速の時間と最大のRSSを記録する
+ */
+bool bench_tool(const std::string &tool, long scale, const hi::StringArray &args, \
+        const std::string &out_fn, const std::string &input_fn, int nRepeats, \
+        BenchResultArray &results, const char *remove_fn=NULL){
+
+    BenchResult result;
+    result.tool = tool;
+    result.scale = scale;
+    result.records = count_records(input_fn, &result.bytes);
+    result.seconds = -1;
+    result.peak_rss = 0;
+
+    double seconds;
+    long peak_rss;
+    for(int i=0; i<nRepeats; ++i){
+        // e.g. the FASTA index is rebuilt every time
+        if(NULL != remove_fn)
+            unlink(remove_fn);
+        if(! run_tool(args, out_fn, &seconds, &peak_rss)){
+            std::cerr << ERROR_STRING << tool << " failed (scale=" << scale << ")." << ENDL;
+            return false;
+        }
+        if(0 > result.seconds || seconds < result.seconds)
+            result.seconds = seconds;
+        result.peak_rss = std::max(result.peak_rss, peak_rss);
+    }
+
+    std::cerr << INFO_STRING << tool << " scale=" << scale << ' ' << result.seconds << " s" << ENDL;
+    results.push_back(result);
+    return true;
+}
+//------------------------------------------------------------------------------
+bool bench_scale(const std::string &bindir, const std::string &dir, long scale, \
+        int nRepeats, BenchResultArray &results){
+
+    const std::string vcf = dir + "/in.vcf", xls = dir + "/vcf2xls.txt";
+    const std::string gf_a = dir + "/gf_a.txt", gf_b = dir + "/gf_b.txt", gf_c = dir + "/gf_c.txt";
+    const std::string merged = dir + "/merge_in.txt";
+    const std::string fai = dir + "/old.fa.fai", new_fai = dir + "/new.fa.fai";
+    hi::StringArray args;
+    bool ret = true;
+
+    args = {bindir + "/vcf2xls", "-i", vcf, \
+            "-a", dir + "/in.gff", "-c", "GT,AD,DP"};
+    ret = ret && bench_tool("vcf2xls", scale, args, xls, vcf, nRepeats, results);
+
+    args = {bindir + "/genotype_filter", "-n", "GATK", "-a", "-d", xls};
+    ret = ret && bench_tool("genotype_filter", scale, args, gf_a, xls, nRepeats, results);
+    args = {bindir + "/genotype_filter", "-n", "MULTI", "-m", "-a", xls};
+    ret = ret && bench_tool("genotype_filter_multi", scale, args, gf_b, xls, nRepeats, results);
+    args = {bindir + "/genotype_filter", "-n", "INV", "-v", xls};
+    ret = ret && bench_tool("genotype_filter_invert", scale, args, gf_c, xls, nRepeats, results);
+
+    // merge_vc reads three genotype_filter results; the sum of them is its input size
+    if(ret){
+        std::ofstream ofs(merged.c_str());
+        const char *parts[] = {gf_a.c_str(), gf_b.c_str(), gf_c.c_str()};
+        for(int i=0; i<3; ++i){
+            std::ifstream ifs(parts[i]);
+            ofs << ifs.rdbuf();
+        }
+    }
+    args = {bindir + "/merge_vc", gf_a, gf_b, gf_c};
+    ret = ret && bench_tool("merge_vc", scale, args, dir + "/merge.txt", merged, nRepeats, results);
+
+    args = {bindir + "/bt_coverage_filter", "-n", "BT", "-t", "0.8", \
+            dir + "/cov.txt"};
+    ret = ret && bench_tool("bt_coverage_filter", scale, args, dir + "/bt.txt", \
+            dir + "/cov.txt", nRepeats, results);
+
+    args = {bindir + "/pindel_vcf_filter", "-i", vcf, \
+            "-o", dir + "/pf_o.vcf", "-x", dir + "/pf_x.vcf"};
+    ret = ret && bench_tool("pindel_vcf_filter", scale, args, "/dev/null", vcf, nRepeats, results);
+
+    args = {bindir + "/adjust_target_location", dir + "/targets.txt", \
+            dir + "/old.fa", dir + "/new.fa", dir + "/adj.txt"};
+    if(ret){
+        unlink(new_fai.c_str());
+        ret = bench_tool("adjust_target_location", scale, args, "/dev/null", \
+                dir + "/targets.txt", nRepeats, results, fai.c_str());
+    }
+    args = {bindir + "/adjust_target_location", "-p", dir + "/targets.txt", \
+            dir + "/old.fa", dir + "/new.fa", dir + "/adj_p.txt"};
+    ret = ret && bench_tool("adjust_target_location_packed", scale, args, "/dev/null", \
+            dir + "/targets.txt", nRepeats, results);
+
+    return ret;
+}
+//------------------------------------------------------------------------------
+inline double records_per_sec(const BenchResult &result){
+    return (0 < result.seconds) ? result.records / result.seconds : 0;
+}
+inline double mb_per_sec(const BenchResult &result){
+    return (0 < result.seconds) ? result.bytes / result.seconds / 1e6 : 0;
+}
+//------------------------------------------------------------------------------
+/**
+ * 結果をJSONで書き出す（1結果1行．compare_baseline()はこの形式を前提とする）
+ */
+void write_json(const BenchResultArray &results, int nSamples, int nRepeats, std::ostream &ost){
+
+    char buf[512];
+    ost << "{" << ENDL;
+    ost << "  \"samples\": " << nSamples << ", \"repeats\": " << nRepeats << "," << ENDL;
+    ost << "  \"results\": [" << ENDL;
+    for(std::size_t i=0; i<results.size(); ++i){
+        const BenchResult &r = results[i];
+        std::snprintf(buf, sizeof(buf), "    {\"tool\": \"%s\", \"scale\": %ld, " \
+                "\"records\": %ld, \"bytes\": %ld, \"seconds\": %.6f, " \
+                "\"records_per_sec\": %.1f, \"mb_per_sec\": %.3f, \"peak_rss_kb\": %ld}%s",
+                r.tool.c_str(), r.scale, r.records, r.bytes, r.seconds, \
+                records_per_sec(r), mb_per_sec(r), r.peak_rss, (i+1<results.size()) ? "," : "");
+        ost << buf << ENDL;
+    }
+    ost << "  ]" << ENDL << "}" << ENDL;
+}
+//------------------------------------------------------------------------------
+/**
+ * 以前の結果（write_json()の出力）と比べ，records/sが許容範囲を超えて低下したものを報告する
+ * @return 低下したものが無ければtrue
+ */
+bool compare_baseline(const char *baseline_fn, const BenchResultArray &results, double tolerance){
+
+    std::ifstream file(baseline_fn, std::ios::in);
+    if(file.fail()){
+        std::cerr << ERROR_STRING << "the baseline (" << baseline_fn << ") open failed." << ENDL;
+        return false;
+    }
+
+    // "tool:scale" -> records/s
+    std::map<std::string, double> baseline;
+    std::string line;
+    char tool[128];
+    long scale;
+    double rate;
+    const char *head;
+    while(std::getline(file, line)){
+        head = std::strstr(line.c_str(), "\"tool\":");
+        if(NULL == head || 2 != std::sscanf(head, "\"tool\": \"%127[^\"]\", \"scale\": %ld", tool, &scale))
+            continue;
+        head = std::strstr(line.c_str(), "\"records_per_sec\":");
+        if(NULL == head || 1 != std::sscanf(head, "\"records_per_sec\": %lf", &rate))
+            continue;
+        std::snprintf(tool + std::strlen(tool), sizeof(tool) - std::strlen(tool), ":%ld", scale);
+        baseline[tool] = rate;
+    }
+
+    bool ret = true;
+    char key[160];
+    for(BenchResultArray::const_iterator r=results.begin(); r!=results.end(); ++r){
+        std::snprintf(key, sizeof(key), "%s:%ld", r->tool.c_str(), r->scale);
+        std::map<std::string, double>::const_iterator hit = baseline.find(key);
+        if(baseline.end() == hit || 0 >= hit->second)
+            continue;
+
+        const double ratio = records_per_sec(*r) / hit->second;
+        const bool isRegressed = (ratio < 1.0 - tolerance);
+        std::cerr << (isRegressed ? WARNING_STRING : INFO_STRING) << key \
+                << " records/s " << hit->second << " -> " << records_per_sec(*r) \
+                << " (x" << ratio << ")" << ENDL;
+        if(isRegressed)
+            ret = false;
+    }
+    return ret;
+}
+//------------------------------------------------------------------------------
+inline void print_usage(const char *cmd){
+    std::cerr << USAGE_STRING << cmd \
+            << " (-b bindir) (-d datadir) (-s scale1,scale2,...) (-n samples)" \
+            << " (-r repeats) (-c baseline.json) (-t tolerance) (-o result.json)" << ENDL;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char **argv){
+
+    std::string bindir=DEFAULT_BINDIR, datadir=DEFAULT_DATADIR;
+    std::string scales=DEFAULT_SCALES, output_fn="-";
+    const char *baseline_fn=NULL;
+    int nSamples=DEFAULT_SAMPLES, nRepeats=DEFAULT_REPEATS;
+    double tolerance=DEFAULT_TOLERANCE;
+
+    int option;
+    while ((option = getopt(argc, argv, "b:d:s:n:r:c:t:o:h")) != -1){
+        switch (option){
+            case 'b':
+                bindir = optarg;
+                break;
+            case 'd':
+                datadir = optarg;
+                break;
+            case 's':
+                scales = optarg;
+                break;
+            case 'n':
+                nSamples = std::max(2, std::atoi(optarg));
+                break;
+            case 'r':
+                nRepeats = std::max(1, std::atoi(optarg));
+                break;
+            case 'c':
+                baseline_fn = optarg;
+                break;
+            case 't':
+                tolerance = std::atof(optarg);
+                break;
+            case 'o':
+                output_fn = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    hi::StringArray scaleList;
+    hi::split(scaleList, scales, ',');
+    BenchResultArray results;
+    for(hi::StringArray::const_iterator iter=scaleList.begin(); iter!=scaleList.end(); ++iter){
+        const long scale = std::atol(iter->c_str());
+        if(0 >= scale)
+            continue;
+        const std::string dir = prepare_dataset(datadir, scale, nSamples);
+        if(! bench_scale(bindir, dir, scale, nRepeats, results))
+            exit(EXIT_FAILURE);
+    }
+
+    if("-" == output_fn)
+        write_json(results, nSamples, nRepeats, std::cout);
+    else{
+        std::ofstream ofs(output_fn.c_str(), std::ios::out);
+        write_json(results, nSamples, nRepeats, ofs);
+    }
+
+    if(NULL != baseline_fn && ! compare_baseline(baseline_fn, results, tolerance))
+        exit(EXIT_FAILURE);
+
+    exit(EXIT_SUCCESS);
+}
@@ -34,25 +34,25 @@
 #define KEY_FRAC        ".frac"
 #define DEFAULT_COVERAGE_THRESHOLD    1.0
 //-----------------------------------------------------------------------------
-bool is_all_present(const hi::StringArray &elements, \
+bool is_all_present(const hi::FieldView &elements, \
         const hi::SzArray &column_pos, float *coverage_threshold){
 
     double frac;
     for(hi::SzArray::const_iterator pos=column_pos.begin(); pos!=column_pos.end(); pos++){
-        if(1.0 - std::atof(elements[*pos].c_str()) > 1e-10)
+        if(1.0 - elements[*pos].to_double() > 1e-10)
             return false;
     }
 
     return true;
 }
 //-----------------------------------------------------------------------------
-bool is_line_specific(const hi::StringArray &elements, \
+bool is_line_specific(const hi::FieldView &elements, \
         const hi::SzArray &column_pos, float *coverage_threshold, size_t *specific_column){
 
     bool isLineSet=false;
     float frac;
     for(size_t pos=0; pos!=column_pos.size(); pos++){
-        frac = std::atof(elements[column_pos.at(pos)].c_str());
+        frac = elements[column_pos.at(pos)].to_double();
         if(frac < *coverage_threshold && false==isLineSet){
             *specific_column = pos;
             isLineSet = true;
@@ -87,7 +87,7 @@ size_t szKeyFrac=std::strlen(KEY_FRAC);
 
     if(argc <= nArg){
         std::cerr << USAGE_STRING << argv[0] \
-                << " (-n program) (-t threshold) input_file" << ENDL;
+                << " (-n program) (-t threshold) (--stats[=json]) input_file" << ENDL;
         exit(EXIT_FAILURE);
     }
 
@@ -95,7 +95,9 @@ size_t szKeyFrac=std::strlen(KEY_FRAC);
     char option;
     std::string program_name="Program";
     float coverage_threshold=DEFAULT_COVERAGE_THRESHOLD;
-    while ((option = getopt(argc, argv, "n:t:")) != -1){
+    hi::RunStats stats;
+    static const struct option long_options[] = {STATS_LONG_OPTION, {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "n:t:", long_options, NULL)) != -1){
         switch (option){
             case 'n':
                 program_name = optarg;
@@ -103,12 +105,15 @@ size_t szKeyFrac=std::strlen(KEY_FRAC);
             case 't':
                 coverage_threshold = std::atof(optarg);
                 break;
+            case 'S':
+                stats.enable(optarg);
+                break;
         }
     }
     const char *input_fn = argv[argc-1];
 
     // open the input file
-    std::ifstream file(input_fn, std::ios::in);
+    hi::InputStream file(input_fn);
     if(file.fail()){
         std::cerr << ERROR_STRING << "the input file (" \
                 << input_fn << ") open failed." << ENDL;
@@ -116,11 +121,13 @@ size_t szKeyFrac=std::strlen(KEY_FRAC);
     }
 
     // find header line, parse & output
+    stats.enter("header_parse");
+    hi::OutputWriter output("-");
     std::string header;
     bool is_header_found=false;
     while(std::getline(file, header)){
         if("##" == header.substr(0, 2)){
-            std::cout << header << ENDL;
+            output << header << ENDL;
             continue;
         }
         else if('#'==header[0] && std::string::npos != header.find(KEY_CHR)){
@@ -138,8 +145,8 @@ size_t szKeyFrac=std::strlen(KEY_FRAC);
     std::string cmdstr = generate_cmd_string(argc, argv);
     std::stringstream inputstr;
     inputstr << "input_fn=" << input_fn;
-    write_basic_header(__FILE__, __DATE__, __TIME__, cmdstr.c_str(), inputstr.str().c_str(), std::cout);
-    std::cout << "#Program\tLine\t" << header.substr(header.find_first_not_of('#')) << "\tLink"<< ENDL;
+    write_basic_header(__FILE__, __DATE__, __TIME__, cmdstr.c_str(), inputstr.str().c_str(), output);
+    output << "#Program\tLine\t" << header.substr(header.find_first_not_of('#')) << "\tLink"<< ENDL;
     hi::StringArray header_elements;
     hi::split(header_elements, header, '\t');
 
@@ -169,33 +176,57 @@ size_t szKeyFrac=std::strlen(KEY_FRAC);
         }
     }
 
+    stats.leave();
+
     // process each record
     std::string line, last_chr="", last_start="", last_end="";
-    hi::StringArray elements;
+    hi::FieldView elements;
     size_t specific_pos;
+    stats.enter("record_parse");
     while(std::getline(file, line)){
-        elements.clear();
-        hi::split(elements, line, '\t');
+        elements.split(line, '\t');
+        stats.count("records_in");
 
         if(elements[chr_column_pos]==last_chr \
                 && elements[start_column_pos]==last_start \
                 && elements[end_column_pos]==last_end){
 
+            stats.count("duplicated_regions");
             continue;
         }
 
-        if(is_line_specific(elements, column_pos, &coverage_threshold, &specific_pos))
-            std::cout << program_name << '\t' << strain_names[specific_pos] \
+        stats.enter("filter");
+        const bool isSpecific = is_line_specific(elements, column_pos, &coverage_threshold, &specific_pos);
+        stats.leave();
+        if(isSpecific){
+            stats.enter("output");
+            output << program_name << '\t' << strain_names[specific_pos] \
             << '\t' << line << '\t' \
             << "=HYPERLINK(\"http://localhost:60151/goto?locus=" \
             << elements[chr_column_pos] << ':' << elements[start_column_pos] \
             << '-' << elements[end_column_pos] \
             << "\", \"link\")" << ENDL;
+            stats.count("records_out");
+            stats.leave();
+        }
+        else
+            stats.count("not_specific");
 
-        last_chr   = elements[chr_column_pos];
-        last_start = elements[start_column_pos];
-        last_end   = elements[end_column_pos];
+        elements[chr_column_pos].assign_to(last_chr);
+        elements[start_column_pos].assign_to(last_start);
+        elements[end_column_pos].assign_to(last_end);
     }
+    stats.leave();
 
+    stats.enter("output");
+    if(! output.close()){
+        std::cerr << ERROR_STRING \
+                << "the output can't write. Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    stats.leave();
+    stats.count("bytes_read", file.bytes_read());
+    stats.count("bytes_written", output.bytes_written());
+    stats.report("bt_coverage_filter");
     exit(EXIT_SUCCESS);
 }
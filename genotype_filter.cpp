@@ -40,56 +40,116 @@ size_t nArg=1;
                 << NUM_NULL_ALLOWED << "]" << ENDL \
                 << " -m  Multi-allelic mode [FALSE]" << ENDL \
                 << " -v  Invert selection [FALSE]" << ENDL \
-                << " -x  Exclude line name []" << ENDL;
+                << " -i  Also write the inverted selection (as -v) to a file []" << ENDL \
+                << " -x  Exclude line name []" << ENDL \
+                << " -t  Number of threads [" << NUM_THREADS << "]" << ENDL \
+                << " -g  Sweep a parameter in one pass, e.g. -g e=0,1,2 -g f=0.3,0.5" \
+                << " (e/r/f/l) []" << ENDL \
+                << " -o  Also write the records of each sweep point to [prefix].e*.r*.f*.l*.txt []" << ENDL \
+                << " --build-cache=FILE  Convert the records of input_fn into a binary cache and exit" << ENDL \
+                << " --cache=FILE  Read the records from a cache built from input_fn" << ENDL \
+                << " --pattern-cache[=N]  Reuse the line-specificity decisions of" \
+                << " up to N genotype patterns [off, N=" << NUM_PATTERN_CACHE << "]" << ENDL \
+                << " --stats[=json]  Report timing and counters to stderr" << ENDL;
         exit(EXIT_FAILURE);
     }
 
     // parse arguments
     char option;
-    bool use_alt_rate_filter=false, use_depth_filter=false;
-    bool allow_multiple_alleles=false, isInvertSelection=false;
-    float maxAltLineFrac=MAX_ALT_RATE;
-    int minSupportReads=MIN_SUPPORT_READS, nHeteroAllowed=NUM_HETERO_ALLOWED;
-    int nNullAllowed=NUM_NULL_ALLOWED;
+    FilterSettings settings;
+    settings.useAltRateFilter = settings.useReadDepthFilter = false;
+    settings.allowMultipleAlleles = settings.isInvertSelection = false;
+    settings.maxAltLineFrac = MAX_ALT_RATE;
+    settings.minSupportReads = MIN_SUPPORT_READS;
+    settings.nHeteroAllowed = NUM_HETERO_ALLOWED;
+    settings.nNullAllowed = NUM_NULL_ALLOWED;
+    settings.numPatternCache = 0;
+    int num_threads=NUM_THREADS;
     StringSet ignoreNames;
+    SweepGrid grid;
+    std::string sweep_prefix;
+    std::string cache_fn, build_cache_fn;
+    std::string inverted_fn;
     std::string program_name=DEFAULT_PROGRAM_NAME;
-    while ((option = getopt(argc, argv, "n:f:r:e:mvadx:l:")) != -1){
+    hi::RunStats stats;
+    static const struct option long_options[] = {STATS_LONG_OPTION, \
+            {"build-cache", required_argument, NULL, 'B'}, \
+            {"cache", required_argument, NULL, 'C'}, \
+            {"pattern-cache", optional_argument, NULL, 'P'}, {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "n:f:r:e:mvadx:l:t:g:o:i:", long_options, NULL)) != -1){
         switch (option){
             case 'n':
                 program_name = optarg;
                 break;
             case 'f':
-                maxAltLineFrac = std::atof(optarg);
+                settings.maxAltLineFrac = std::atof(optarg);
                 break;
             case 'r':
-                minSupportReads = std::atoi(optarg);
+                settings.minSupportReads = std::atoi(optarg);
                 break;
             case 'e':
-                nHeteroAllowed = std::atoi(optarg);
+                settings.nHeteroAllowed = std::atoi(optarg);
                 break;
             case 'm':
-                allow_multiple_alleles = true;
+                settings.allowMultipleAlleles = true;
                 break;
             case 'v':
-                isInvertSelection = true;
+                settings.isInvertSelection = true;
             case 'a':
-                use_alt_rate_filter = true;
+                settings.useAltRateFilter = true;
                 break;
             case 'd':
-                use_depth_filter = true;
+                settings.useReadDepthFilter = true;
                 break;
             case 'x':
                 ignoreNames.insert(optarg);
                 break;
             case 'l':
-                nNullAllowed = std::atoi(optarg);
+                settings.nNullAllowed = std::atoi(optarg);
+                break;
+            case 't':
+                num_threads = std::max(1, std::atoi(optarg));
+                break;
+            case 'g':
+                if(! add_sweep_values(grid, optarg)){
+                    std::cerr << ERROR_STRING << "invalid sweep values (" \
+                            << optarg << "). e.g. -g e=0,1,2" << ENDL;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                sweep_prefix = optarg;
+                break;
+            case 'i':
+                inverted_fn = optarg;
+                break;
+            case 'S':
+                stats.enable(optarg);
+                break;
+            case 'B':
+                build_cache_fn = optarg;
+                break;
+            case 'C':
+                cache_fn = optarg;
+                break;
+            case 'P':
+                settings.numPatternCache = \
+                        (NULL==optarg) ? NUM_PATTERN_CACHE : std::max(0, std::atoi(optarg));
                 break;
         }
     }
     const char *input_fn = argv[optind];
+    if(! inverted_fn.empty() && settings.isInvertSelection){
+        std::cerr << ERROR_STRING << "-i can't be used with -v." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    if(! inverted_fn.empty() && ! grid.empty()){
+        std::cerr << WARNING_STRING << "-i is ignored with -g." << ENDL;
+        inverted_fn.clear();
+    }
 
     // open the input file
-    std::ifstream file(input_fn, std::ios::in);
+    hi::InputStream file(input_fn, 1<num_threads ? num_threads : 0);
     if(file.fail()){
         std::cerr << ERROR_STRING \
                 << "the input file (" << input_fn << ") open failed." << ENDL;
@@ -97,12 +157,18 @@ size_t nArg=1;
     }
 
     // find header
-    bool isProgDefined=false;
-    int posChrom;
+    stats.enter("header_parse");
+    hi::OutputWriter output("-");
+    hi::OutputBuffer header;
+    bool &isProgDefined=settings.isProgDefined;
+    int &posChrom=settings.posChrom;
+    isProgDefined = false;
     std::string header_line;
+    uint64_t header_bytes=0;    // the offset of the first record (for the cache)
     while(std::getline(file, header_line)){
+        header_bytes += header_line.size() + 1;
         if("##" == header_line.substr(0, 2)){
-            std::cout << header_line << ENDL;
+            header << header_line << ENDL;
             continue;
         }
         else if('#'==header_line[0]){
@@ -136,9 +202,8 @@ size_t nArg=1;
     }
 
     // determine the positions of '_GT' columns
-    IntArray gtColumns;
     if(! find_column_positions( \
-            header_elements, KEY_GT, ignoreNames, gtColumns)){
+            header_elements, KEY_GT, ignoreNames, settings.gtColumns)){
 
         std::cerr << ERROR_STRING << "invalid header structure. \"" \
                 << KEY_GT << "\" wasn't found. " << ENDL;
@@ -147,74 +212,213 @@ size_t nArg=1;
 
     // determine the range of '_DP' columns
     IntArray dpColumns;
-    if(use_depth_filter \
+    if(settings.useReadDepthFilter \
             && false==find_column_positions( \
                 header_elements, KEY_DP, ignoreNames, dpColumns)){
 
         std::cerr << ERROR_STRING << "invalid header structure. \"" \
                 << KEY_DP << "\" wasn't found. " << ENDL \
                 << "Read depth filter was inactivated." << ENDL;
-        use_depth_filter = false;
+        settings.useReadDepthFilter = false;
     }
 
     // determine the range of '_AD' columns
-    IntArray adColumns;
-    if(use_alt_rate_filter \
+    // (the read depth filter takes the depth of a mutant allele from them, too,
+    // and -v, which -i follows, turns the alt rate filter on)
+    if((settings.useAltRateFilter || settings.useReadDepthFilter || ! inverted_fn.empty()) \
             && false==find_column_positions( \
-                header_elements, KEY_AD, ignoreNames, adColumns)){
+                header_elements, KEY_AD, ignoreNames, settings.adColumns)){
         std::cerr << ERROR_STRING << "invalid header structure. \"" \
-                << KEY_AD << "\" wasn't found. " << ENDL \
-                << "Alt rate filter was inactivated." << ENDL;
-        use_alt_rate_filter = false;
+                << KEY_AD << "\" wasn't found. " << ENDL;
+        if(settings.useAltRateFilter)
+            std::cerr << "Alt rate filter was inactivated." << ENDL;
+        if(settings.useReadDepthFilter)
+            std::cerr << "Read depth filter was inactivated." << ENDL;
+        settings.useAltRateFilter = settings.useReadDepthFilter = false;
     }
 
     // column -> strain name
-    ColumnToName names;
-    create_column_to_name(header_elements, gtColumns, KEY_GT, names);
+    create_column_to_name(header_elements, settings.gtColumns, KEY_GT, settings.names);
+
+    // convert the records of all lines into a cache, and exit
+    if(! build_cache_fn.empty()){
+        FilterSettings cache_settings = settings;
+        cache_settings.gtColumns.clear();
+        cache_settings.adColumns.clear();
+        find_column_positions(header_elements, KEY_GT, StringSet(), cache_settings.gtColumns);
+        find_column_positions(header_elements, KEY_AD, StringSet(), cache_settings.adColumns);
+        stats.leave();
+
+        stats.enter("cache_build");
+        if(! build_genotype_cache(file, header_bytes, input_fn, \
+                build_cache_fn.c_str(), cache_settings, stats)){
+            std::cerr << ERROR_STRING << "the cache file (" << build_cache_fn \
+                    << ") build failed." << ENDL;
+            std::remove(build_cache_fn.c_str());
+            exit(EXIT_FAILURE);
+        }
+        stats.leave();
+
+        file.close();
+        stats.count("bytes_read", file.bytes_read());
+        stats.report("genotype_filter");
+        exit(EXIT_SUCCESS);
+    }
+
+    // the inverted selection of -i: the same as a run with -v, which also
+    // counts the alleles from '_AD' as the alt rate filter does
+    FilterSettings inverted_settings = settings;
+    inverted_settings.isInvertSelection = true;
+    inverted_settings.useAltRateFilter = ! settings.adColumns.empty();
+    const FilterSettings *inverted = inverted_fn.empty() ? NULL : &inverted_settings;
+    hi::RunStats inverted_stats;
+    if(stats.is_enabled())
+        inverted_stats.enable_counters();
+
+    // read the records from the cache instead of the text
+    GenotypeCache cache;
+    if(! cache_fn.empty()){
+        if(1 < num_threads)
+            std::cerr << WARNING_STRING << "-t is ignored with --cache." << ENDL;
+        num_threads = 1;
+        if(! cache.open(cache_fn.c_str(), input_fn, settings.gtColumns, settings.adColumns)){
+            std::cerr << ERROR_STRING << "the cache file (" << cache_fn \
+                    << ") open failed, or it wasn't built from " << input_fn \
+                    << ". Rebuild it with --build-cache." << ENDL;
+            exit(EXIT_FAILURE);
+        }
+    }
+    RecordReader reader(file, cache.is_open() ? &cache : NULL);
 
     // header
     std::string cmdstr = generate_cmd_string(argc, argv);
     std::stringstream sstr;
     sstr << "input_fn=" << input_fn;
     write_basic_header(__FILE__, __DATE__, __TIME__, \
-            cmdstr.c_str(), sstr.str().c_str(), std::cout);
-    std::cout << '#' << KEY_PROGRAM << '\t' << "Line" << '\t' \
+            cmdstr.c_str(), sstr.str().c_str(), header);
+    header << '#' << KEY_PROGRAM << '\t' << "Line" << '\t' \
             <<  header_line.substr(1) << ENDL;
+    if(grid.empty())
+        output.write(header.data(), header.size());
+    hi::OutputWriter inverted_output;
+    if(NULL != inverted){
+        inverted_output.open(inverted_fn.c_str());
+        if(inverted_output.fail()){
+            std::cerr << ERROR_STRING \
+                    << "the output file (" << inverted_fn << ") open failed." << ENDL;
+            exit(EXIT_FAILURE);
+        }
+        inverted_output.write(header.data(), header.size());
+    }
+    stats.leave();
 
     // process records
-    std::string line;
-    hi::StringArray elements;
-    int num_alleles=2;
-    while(std::getline(file, line)){
-        elements.clear();
-        hi::split(elements, line, '\t');
-
-        // get the max number of alleles in the records
-        if(use_alt_rate_filter)
-            num_alleles = get_max_alleles(elements, adColumns);
-
-        // remove decision from previous run
-        if(isProgDefined){
-            program_name = elements.at(0);
-            elements.erase(elements.begin(), elements.begin()+posChrom);
+    stats.enter("record_parse");
+    if(! grid.empty()){
+        // parameter sweep: the counts of each combination, in one pass
+        if(1 < num_threads)
+            std::cerr << WARNING_STRING << "-t is ignored with -g." << ENDL;
+        create_sweep_points(grid, settings);
+        if(sweep_prefix.empty()){
+            NullOutput null_output;
+            std::vector<NullOutput *> outputs(grid.points.size(), &null_output);
+            sweep_records(reader, program_name, settings, grid, outputs, stats);
+        }
+        else{
+            std::vector<hi::OutputWriter *> outputs;
+            for(SweepPointArray::const_iterator \
+                    point=grid.points.begin(); point!=grid.points.end(); ++point){
+
+                const std::string fn = sweep_output_name(sweep_prefix, *point);
+                outputs.push_back(new hi::OutputWriter(fn.c_str()));
+                if(outputs.back()->fail()){
+                    std::cerr << ERROR_STRING \
+                            << "the output file (" << fn << ") open failed." << ENDL;
+                    exit(EXIT_FAILURE);
+                }
+                outputs.back()->write(header.data(), header.size());
+            }
+            sweep_records(reader, program_name, settings, grid, outputs, stats);
+
+            stats.enter("output");
+            bool isWritten = true;
+            for(std::size_t i=0; i<outputs.size(); ++i){
+                if(! outputs[i]->close()){
+                    std::cerr << ERROR_STRING << "the output file (" \
+                            << sweep_output_name(sweep_prefix, grid.points[i]) \
+                            << ") can't write." << ENDL;
+                    isWritten = false;
+                }
+                delete outputs[i];
+            }
+            if(! isWritten){
+                std::cerr << ERROR_STRING << "Program execution aborted." << ENDL;
+                exit(EXIT_FAILURE);
+            }
+            stats.leave();
         }
 
-        if(2==num_alleles){
-            proc_by_two_alleles_mode( \
-                elements, names, program_name, \
-                gtColumns, adColumns, &nHeteroAllowed, &nNullAllowed, \
-                &use_alt_rate_filter, &maxAltLineFrac, \
-                &use_depth_filter, &minSupportReads, &isInvertSelection);
+        write_basic_header(__FILE__, __DATE__, __TIME__, \
+                cmdstr.c_str(), sstr.str().c_str(), output);
+        write_sweep_table(grid, output);
+    }
+    else if(1 == num_threads){
+        filter_records(reader, program_name, settings, output, stats, \
+                inverted, &inverted_output, inverted_stats);
+    }
+    else{
+        // records are independent, so chunks of them are filtered in parallel
+        // and the results are written in the input order
+        hi::ThreadPool pool(num_threads);
+        std::deque<RecordChunk *> chunks;
+        const std::size_t max_chunks = 2*num_threads;
+        std::string rest;
+        while(true){
+            RecordChunk *chunk = new RecordChunk;
+            if(! read_record_chunk(file, rest, chunk->data)){
+                delete chunk;
+                break;
+            }
+            if(stats.is_enabled()){
+                chunk->stats.enable_counters();
+                chunk->inverted_stats.enable_counters();
+            }
+            chunk->task = pool.submit( \
+                    std::bind(filter_chunk, chunk, &settings, inverted, &program_name));
+            chunks.push_back(chunk);
+            if(max_chunks <= chunks.size()){
+                write_record_chunk(chunks.front(), output, \
+                        (NULL==inverted) ? NULL : &inverted_output, stats, inverted_stats);
+                chunks.pop_front();
+            }
         }
-        else if(allow_multiple_alleles && 3<=num_alleles){
-            proc_by_multiple_alleles_mode( \
-                elements, names, program_name, \
-                gtColumns, adColumns, &nHeteroAllowed, &nNullAllowed, \
-                &isInvertSelection);
+        for(; ! chunks.empty(); chunks.pop_front()){
+            write_record_chunk(chunks.front(), output, \
+                    (NULL==inverted) ? NULL : &inverted_output, stats, inverted_stats);
         }
     }
+    stats.leave();
 
     file.close();
+    stats.enter("output");
+    if(! output.close()){
+        std::cerr << ERROR_STRING \
+                << "the output can't write. Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    if(NULL != inverted && ! inverted_output.close()){
+        std::cerr << ERROR_STRING << "the output file (" << inverted_fn \
+                << ") can't write. Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    stats.leave();
+    if(NULL != inverted){
+        stats.count("inverted.records_out", inverted_stats.counter("records_out"));
+        stats.count("bytes_written", inverted_output.bytes_written());
+    }
+    stats.count("bytes_read", file.bytes_read());
+    stats.count("bytes_written", output.bytes_written());
+    stats.report("genotype_filter");
     exit(EXIT_SUCCESS);
 }
 //------------------------------------------------------------------------------
@@ -28,8 +28,13 @@
 #include <string>
 #include <cstring>
 #include <cstdio>
+#include <stdint.h>
 #include <map>
 #include <set>
+#include <deque>
+#include <future>
+#include <functional>
+#include <algorithm>
 
 #define KEY_00      "0|0"
 #define KEY_11      "1|1"
@@ -47,124 +52,388 @@
 #define MAX_ALT_RATE        0.05
 #define MAX_ALT_LINE_FRAC   0.5
 #define MAX_HETERO_BIAS     3.0     // float
+#define NUM_THREADS         1
+#define SZ_RECORD_CHUNK     (4 << 20)   // -tで各スレッドに渡す入力の大きさ
+#define NUM_PATTERN_CACHE   4096        // --pattern-cacheで覚えておく遺伝子型の並びの数
 //------------------------------------------------------------------------------
 typedef std::vector<int> IntArray;
 typedef std::set<std::string> StringSet;
 typedef std::map<int, std::string> ColumnToName;
 //------------------------------------------------------------------------------
+// Genotype::state
+#define GT_STATE_OTHER  0   // 上記以外（"0/1"，"1|."など）
+#define GT_STATE_PHASED 1   // "a|b"の3文字
+#define GT_STATE_NULL   2   // KEY_NULLまたはKEY_EMPTY
+//------------------------------------------------------------------------------
+/**
+ * 1系統分の遺伝子型（"_GT"カラム）をレコード毎に1度だけ解読したもの
+ * allele[]には区切り文字を挟んだ両端の文字を c-'0' として格納する
+ * （数字は0-9になり，それ以外の文字・範囲外の'\0'も互いに区別される）
+ */
+struct Genotype{
+    uint8_t allele[2];
+    uint8_t state;
+};
+typedef std::vector<Genotype> GenotypeArray;
+//------------------------------------------------------------------------------
+/**
+ * "_GT"カラムを解読する
+ * @param arr       行をタブ区切りでパーズした配列
+ * @param gtColumns Genotypeのカラムを列挙した配列
+ * @param genotypes 解読結果（gtColumnsと同じ順）
+ */
+void decode_genotypes(const hi::FieldView &arr, const IntArray &gtColumns, \
+        GenotypeArray &genotypes){
+
+    genotypes.resize(gtColumns.size());
+    for(std::size_t i=0; i<gtColumns.size(); ++i){
+        const hi::FieldRef cell = arr[gtColumns[i]];
+        Genotype &gt = genotypes[i];
+        gt.allele[0] = uint8_t(cell[0] - '0');
+        gt.allele[1] = uint8_t(cell[2] - '0');
+        if(0==cell.len || (1==cell.len && '.'==cell.ptr[0]))
+            gt.state = GT_STATE_NULL;
+        else if(3==cell.len && '|'==cell.ptr[1])
+            gt.state = GT_STATE_PHASED;
+        else
+            gt.state = GT_STATE_OTHER;
+    }
+}
+//------------------------------------------------------------------------------
+/**
+ * 遺伝子型が"allele|allele"であるか否かを検定する
+ * @param genotype 遺伝子型
+ * @param allele   対立遺伝子の番号（KEY_00なら0，KEY_11なら1）
+ */
+inline bool is_phased_homozygous(const Genotype &genotype, const uint8_t allele){
+    return GT_STATE_PHASED==genotype.state \
+            && allele==genotype.allele[0] && allele==genotype.allele[1];
+}
+//------------------------------------------------------------------------------
 /**
  * 遺伝子型がホモ接合か否かを検定する
- * @param genotype 遺伝子型（3文字，区切り文字を挟んだ両端を比較する）
+ * @param genotype 遺伝子型（区切り文字を挟んだ両端を比較する）
  * @return 遺伝子型がホモ接合か否か
  */
-bool is_homozygous(const std::string &genotype){
-
-    if(genotype[0]==genotype[2])
-        return true;
-
-    return false;
+inline bool is_homozygous(const Genotype &genotype){
+    return genotype.allele[0]==genotype.allele[1];
 }
 //------------------------------------------------------------------------------
 /**
  * 遺伝子型が同じ対立遺伝子のみからなるか否かを検定する
- * @param gtype1 遺伝子型1（3文字，区切り文字を挟んだ両端を比較する）
- * @param gtype2 遺伝子型2（3文字，区切り文字を挟んだ両端を比較する）
+ * @param gtype1 遺伝子型1
+ * @param gtype2 遺伝子型2
  * @return 与えられた2つの遺伝子型が同じ対立遺伝子のみからなるか否か
  */
-bool is_by_same_alleles(const std::string &gtype1, const std::string &gtype2){
+inline bool is_by_same_alleles(const Genotype &gtype1, const Genotype &gtype2){
 
-    if('0'!=gtype1[0] && gtype1[0]!=gtype2[0] && gtype1[0]!=gtype2[2])
+    if(0!=gtype1.allele[0] && gtype1.allele[0]!=gtype2.allele[0] \
+            && gtype1.allele[0]!=gtype2.allele[1])
         return false;
-    if('0'!=gtype1[2] && gtype1[2]!=gtype2[0] && gtype1[2]!=gtype2[2])
+    if(0!=gtype1.allele[1] && gtype1.allele[1]!=gtype2.allele[0] \
+            && gtype1.allele[1]!=gtype2.allele[1])
         return false;
 
     return true;
 }
 //------------------------------------------------------------------------------
+// ハッシュ値にvalueを混ぜる
+inline uint64_t combine_hash(const uint64_t hash, const uint64_t value){
+    return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+//------------------------------------------------------------------------------
+/**
+ * 遺伝子型毎の系統の集合（系統の番号を64系統ずつuint64_tに詰めたビット集合）
+ * is_line_specific()は判定に関わらない系統をこれで読み飛ばす
+ * ビット集合と，どれにも属さない系統の遺伝子型でis_line_specific()の結果が決まるので，
+ * これをSpecificityCacheのキーにする（assign()でwithPatternを指定した場合のみ）
+ */
+class CarrierSets{
+public:
+    void assign(const GenotypeArray &genotypes, const bool withPattern);
+    std::size_t num_words(void) const { return this->Null.size(); }
+    // w番目のワードのうち系統に対応するビット
+    uint64_t valid_bits(const std::size_t w) const {
+        return (w+1 < this->Null.size() || 0 == this->NumLines % 64) \
+                ? ~(uint64_t)0 : ((uint64_t)1 << (this->NumLines % 64)) - 1;
+    }
+    // 遺伝子型不明（GT_STATE_NULL）の系統
+    const uint64_t * null_lines(void) const { return this->Null.data(); }
+    std::size_t num_null(void) const { return this->NumNull; }
+    // "allele|allele"の系統（alleleは0または1）
+    const uint64_t * phased_homozygous(const uint8_t allele) const {
+        return (0==allele) ? this->HomRef.data() : this->HomAlt.data();
+    }
+    // 遺伝子型の並びのハッシュ値
+    uint64_t hash(void) const { return this->Hash; }
+    // assign()する度に変わる番号
+    uint64_t serial(void) const { return this->Serial; }
+    bool is_same_pattern(const CarrierSets &other) const;
+    CarrierSets();
+
+private:
+    std::vector<uint64_t> Null, HomRef, HomAlt;
+    IntArray OtherLines;            // どのビット集合にも属さない系統
+    GenotypeArray OtherGenotypes;   // その遺伝子型
+    std::size_t NumLines, NumNull;
+    uint64_t Hash, Serial;
+};
+//------------------------------------------------------------------------------
+CarrierSets::CarrierSets(){
+    this->NumLines = this->NumNull = 0;
+    this->Hash = this->Serial = 0;
+}
+//------------------------------------------------------------------------------
+void CarrierSets::assign(const GenotypeArray &genotypes, const bool withPattern){
+
+    const std::size_t num_words = (genotypes.size() + 63) / 64;
+    this->Null.assign(num_words, 0);
+    this->HomRef.assign(num_words, 0);
+    this->HomAlt.assign(num_words, 0);
+    this->NumLines = genotypes.size();
+    this->NumNull = 0;
+    ++this->Serial;
+    for(std::size_t i=0; i<genotypes.size(); ++i){
+        const Genotype &gt = genotypes[i];
+        const uint64_t bit = (uint64_t)1 << (i % 64);
+        if(GT_STATE_NULL==gt.state){
+            this->Null[i/64] |= bit;
+            ++this->NumNull;
+        }
+        else if(is_phased_homozygous(gt, 0))
+            this->HomRef[i/64] |= bit;
+        else if(is_phased_homozygous(gt, 1))
+            this->HomAlt[i/64] |= bit;
+    }
+
+    this->OtherLines.clear();
+    this->OtherGenotypes.clear();
+    this->Hash = 0;
+    if(! withPattern)
+        return;
+
+    uint64_t hash = this->NumLines;
+    for(std::size_t w=0; w<num_words; ++w){
+        hash = combine_hash(hash, this->Null[w]);
+        hash = combine_hash(hash, this->HomRef[w]);
+        hash = combine_hash(hash, this->HomAlt[w]);
+
+        uint64_t bits = ~(this->Null[w] | this->HomRef[w] | this->HomAlt[w]) \
+                & this->valid_bits(w);
+        for(; 0!=bits; bits&=bits-1){
+            const int pos = w*64 + __builtin_ctzll(bits);
+            const Genotype &gt = genotypes[pos];
+            this->OtherLines.push_back(pos);
+            this->OtherGenotypes.push_back(gt);
+            hash = combine_hash(hash, ((uint64_t)pos << 24) \
+                    | (gt.allele[0] << 16) | (gt.allele[1] << 8) | gt.state);
+        }
+    }
+    this->Hash = hash;
+}
+//------------------------------------------------------------------------------
+// 遺伝子型の並びがis_line_specific()にとって同じか否か
+bool CarrierSets::is_same_pattern(const CarrierSets &other) const{
+
+    return this->Hash == other.Hash && this->NumLines == other.NumLines \
+            && this->Null == other.Null && this->HomRef == other.HomRef \
+            && this->HomAlt == other.HomAlt && this->OtherLines == other.OtherLines \
+            && 0 == std::memcmp(this->OtherGenotypes.data(), other.OtherGenotypes.data(), \
+                this->OtherGenotypes.size() * sizeof(Genotype));
+}
+//------------------------------------------------------------------------------
 /**
  * 変異が系統特異的か否かを検定する
- * @param  arr                 行をタブ区切りでパーズした配列
- * @param  gtColumns           判定に用いるGenotypeのカラムを列挙した配列
+ * 遺伝子型不明と"null_allele|null_allele"の系統はビット集合で読み飛ばし，
+ * 残りの系統だけを順に調べる
+ * @param  genotypes           decode_genotypes()で解読した遺伝子型
+ * @param  carriers            genotypesから作ったビット集合
  * @param  max_hetero          許容するヘテロ接合の系統数
- * @param  null_genotype       Genotypeが不明と見なす文字列
+ * @param  max_null_allowed    許容する遺伝子型不明の系統数
+ * @param  null_allele         "null_allele|null_allele"を判定対象外と見なす（0または1）
  * @param  specificColumnIndex 特異的な系統のカラム位置
  * @return                     変異が系統特異的であるか否か
  */
-bool is_line_specific(const hi::StringArray &arr, \
-        const IntArray &gtColumns,  const int *max_hetero, \
-        const int *max_null_allowed, const char *null_genotype, \
-        int *specificColumnIndex){
+bool is_line_specific(const GenotypeArray &genotypes, const CarrierSets &carriers, \
+        const int *max_hetero, const int *max_null_allowed, \
+        const uint8_t null_allele, int *specificColumnIndex){
 
-    int mutant_pos_index=-1, num_hetero=0, num_null=0;
+    int mutant_pos_index=-1, num_hetero=0;
     bool isTargetHeterozygous=false, isHomo, isBySameAlleles;
 
-    for(IntArray::const_iterator \
-            pos=gtColumns.begin(); pos!=gtColumns.end(); ++pos){
+    if(*max_null_allowed < (int)carriers.num_null()){
+        *specificColumnIndex = -1;
+        return false;
+    }
 
-        if(KEY_NULL==arr[*pos] || KEY_EMPTY==arr[*pos]){
-            ++num_null;
-            continue;
-        }
-        else if(null_genotype==arr[*pos])
-            continue;
+    const uint64_t *nulls = carriers.null_lines();
+    const uint64_t *background = carriers.phased_homozygous(null_allele);
+    for(std::size_t w=0; w<carriers.num_words(); ++w){
+        uint64_t bits = ~(nulls[w] | background[w]) & carriers.valid_bits(w);
+        for(; 0!=bits; bits&=bits-1){
+            const int pos = w*64 + __builtin_ctzll(bits);
+            const Genotype &gt = genotypes[pos];
 
-        if(*max_null_allowed < num_null){
-            *specificColumnIndex = -1;
-            return false;
-        }
+            isHomo = is_homozygous(gt);
+            if(0 > mutant_pos_index){
+                // this means a specific mutant hasn't been found yet
+                mutant_pos_index = pos;
+                if(! isHomo)
+                    isTargetHeterozygous = true;
+                continue;
+            }
 
-        isHomo = is_homozygous(arr[*pos]);
-        if(0 > mutant_pos_index){
-            // this means a specific mutant hasn't been found yet
-            mutant_pos_index = std::distance(gtColumns.begin(), pos);
-            if(! isHomo)
-                isTargetHeterozygous = true;
-            continue;
-        }
+            isBySameAlleles = is_by_same_alleles(genotypes[mutant_pos_index], gt);
 
-        isBySameAlleles = is_by_same_alleles( \
-                arr[gtColumns.at(mutant_pos_index)], arr[*pos]);
+            if(isTargetHeterozygous && isHomo){
+                // ヘテロ接合の個体における変異として登録されていて，
+                // 後からホモ接合の個体が見つかった場合
+                mutant_pos_index = pos;
+                isTargetHeterozygous = false;
 
-        if(isTargetHeterozygous && isHomo){
-            // ヘテロ接合の個体における変異として登録されていて，
-            // 後からホモ接合の個体が見つかった場合
-            mutant_pos_index = std::distance(gtColumns.begin(), pos);
-            isTargetHeterozygous = false;
+                if(isBySameAlleles){
+                    ++num_hetero;
+                    if(num_hetero > *max_hetero){
+                        *specificColumnIndex = -1;
+                        return false;
+                    }
+                }
+                continue;
+            }
 
-            if(isBySameAlleles){
+            if(isHomo && isBySameAlleles){
+                // 同じアリルの組み合わせからなるホモ接合体が見つかった場合
+                // 無条件にreject
+                *specificColumnIndex = -1;
+                return false;
+            }
+            else if(isBySameAlleles){
+                // 同じアリルのヘテロ接合体の場合
+                // これまでに出現したヘテロの数がmax_heteroを超える場合はreject
                 ++num_hetero;
                 if(num_hetero > *max_hetero){
                     *specificColumnIndex = -1;
                     return false;
                 }
             }
-            continue;
         }
+    }
 
-        if(isHomo && isBySameAlleles){
-            // 同じアリルの組み合わせからなるホモ接合体が見つかった場合
-            // 無条件にreject
-            *specificColumnIndex = -1;
-            return false;
-        }
-        else if(isBySameAlleles){
-            // 同じアリルのヘテロ接合体の場合
-            // これまでに出現したヘテロの数がmax_heteroを超える場合はreject
-            ++num_hetero;
-            if(num_hetero > *max_hetero){
-                *specificColumnIndex = -1;
-                return false;
-            }
-        }
+    *specificColumnIndex = mutant_pos_index;
+    return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * is_line_specific()の結果を遺伝子型の並び毎に覚えておく（スレッド毎に1つ）
+ * 並び毎に1つの枠を使い，その中に条件（-e/-l/null_allele）毎の結果を並べる
+ * 枠の数は固定し，同じ位置に入る並びは上書きする．枠が無ければ毎回判定する
+ */
+class SpecificityCache{
+public:
+    bool is_line_specific(const GenotypeArray &genotypes, const CarrierSets &carriers, \
+            const int *max_hetero, const int *max_null_allowed, \
+            const uint8_t null_allele, int *specificColumnIndex);
+    // 枠の数を変える（0なら使わない）
+    void resize(const std::size_t num_entries);
+    bool is_enabled(void) const { return ! this->Entries.empty(); }
+    // ヒット・ミスの回数をstatsに加えて0に戻す
+    void report(hi::RunStats &stats);
+    SpecificityCache();
+
+private:
+    struct Decision{
+        int max_hetero, max_null_allowed;
+        uint8_t null_allele;
+        bool isSpecific;
+        int specific_column_index;
+    };
+    struct Entry{
+        CarrierSets pattern;
+        std::vector<Decision> decisions;
+    };
+    Entry * find_entry(const CarrierSets &carriers);
+    std::vector<Entry> Entries;
+    Entry *Current;             // 直前に調べたレコードの枠
+    uint64_t CurrentSerial;
+    long long Hits, Misses;
+};
+//------------------------------------------------------------------------------
+SpecificityCache::SpecificityCache(){
+    this->Current = NULL;
+    this->CurrentSerial = 0;
+    this->Hits = this->Misses = 0;
+}
+//------------------------------------------------------------------------------
+void SpecificityCache::resize(const std::size_t num_entries){
+
+    if(num_entries == this->Entries.size())
+        return;
+    this->Entries.clear();
+    this->Entries.resize(num_entries);
+    this->Current = NULL;
+}
+//------------------------------------------------------------------------------
+// 遺伝子型の並びの枠（無ければ空にした枠）を返す．同じレコードでは探し直さない
+SpecificityCache::Entry * SpecificityCache::find_entry(const CarrierSets &carriers){
+
+    if(NULL != this->Current && carriers.serial() == this->CurrentSerial)
+        return this->Current;
+
+    uint64_t key = carriers.hash();
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    Entry &entry = this->Entries[key % this->Entries.size()];
+    if(! entry.pattern.is_same_pattern(carriers)){
+        entry.pattern = carriers;
+        entry.decisions.clear();
     }
+    this->Current = &entry;
+    this->CurrentSerial = carriers.serial();
+    return this->Current;
+}
+//------------------------------------------------------------------------------
+/**
+ * ::is_line_specific()と同じ（引数も同じ）
+ */
+bool SpecificityCache::is_line_specific(const GenotypeArray &genotypes, \
+        const CarrierSets &carriers, const int *max_hetero, const int *max_null_allowed, \
+        const uint8_t null_allele, int *specificColumnIndex){
 
-    if(*max_null_allowed < num_null){
-        *specificColumnIndex = -1;
-        return false;
+    if(! this->is_enabled())
+        return ::is_line_specific(genotypes, carriers, \
+                max_hetero, max_null_allowed, null_allele, specificColumnIndex);
+
+    Entry *entry = this->find_entry(carriers);
+    for(std::vector<Decision>::const_iterator \
+            iter=entry->decisions.begin(); iter!=entry->decisions.end(); ++iter){
+
+        if(iter->max_hetero == *max_hetero && iter->max_null_allowed == *max_null_allowed \
+                && iter->null_allele == null_allele){
+            ++this->Hits;
+            *specificColumnIndex = iter->specific_column_index;
+            return iter->isSpecific;
+        }
     }
 
-    *specificColumnIndex = mutant_pos_index;
-    return true;
+    ++this->Misses;
+    Decision decision;
+    decision.max_hetero = *max_hetero;
+    decision.max_null_allowed = *max_null_allowed;
+    decision.null_allele = null_allele;
+    decision.isSpecific = ::is_line_specific(genotypes, carriers, \
+            max_hetero, max_null_allowed, null_allele, specificColumnIndex);
+    decision.specific_column_index = *specificColumnIndex;
+    entry->decisions.push_back(decision);
+    return decision.isSpecific;
+}
+//------------------------------------------------------------------------------
+void SpecificityCache::report(hi::RunStats &stats){
+    if(! this->is_enabled())
+        return;
+    stats.count("specificity_cache.hit", this->Hits);
+    stats.count("specificity_cache.miss", this->Misses);
+    this->Hits = this->Misses = 0;
 }
 //------------------------------------------------------------------------------
 /**
@@ -214,51 +483,163 @@ bool find_column_position(hi::StringArray &header_elements, \
 }
 //------------------------------------------------------------------------------
 /**
- * 対立遺伝子の数を調べる
- * @param adepth AllelicDepthの文字列
- * @return 対立遺伝子の数
+ * 1レコード分の"_AD"カラムを整数に変換したもの（系統×対立遺伝子）
+ * 系統毎に値の数が異なるため，値は1つの配列に詰めて系統毎の開始位置を持つ
+ * 同じオブジェクトを使い回せばレコード毎のメモリ割り当ては発生しない
+ */
+class DepthMatrix{
+public:
+    void parse(const hi::FieldView &arr, const IntArray &adColumns);
+    void assign(const uint8_t *counts, const uint8_t *alleles, const uint16_t *values, \
+            const std::size_t num_columns, const IntArray &index);
+    // 系統の数
+    std::size_t size(void) const { return this->Counts.size(); }
+    // 系統iの値の数（hi::split_int()と同じ数え方．"5|"は1つ）
+    std::size_t num_values(std::size_t i) const { return this->Counts[i]; }
+    // 系統iの値（num_values(i)個）
+    const int * values(std::size_t i) const { return &this->Values[0] + this->Starts[i]; }
+    // 系統iの対立遺伝子の数（'|'の数+1）
+    int num_alleles(std::size_t i) const { return this->Alleles[i]; }
+    // レコード全体の対立遺伝子の最大数（'|'の数+1．値が無い場合は0）
+    int max_alleles(void) const { return this->MaxAlleles; }
+
+private:
+    std::vector<int> Values;
+    hi::SzArray Starts, Counts, Offsets;
+    IntArray Alleles;
+    int MaxAlleles;
+};
+//------------------------------------------------------------------------------
+// FieldRef::to_int()と同じ値（数字だけの短い値は直接変換する）
+inline int parse_depth(const char *begin, const char *end, \
+        const unsigned int value, const bool isDigitsOnly){
+
+    if(isDigitsOnly && end - begin <= 9 && begin != end)
+        return (int)value;
+    return hi::FieldRef(begin, end-begin).to_int();
+}
+//------------------------------------------------------------------------------
+/**
+ * "_AD"カラムを全て1度に変換する
+ * @param arr       行をタブ区切りでパーズした配列
+ * @param adColumns AllelicDepthのカラムの位置
  */
-int get_num_alleles(const std::string &adepth){
-    const char *adcstr = adepth.c_str();
-    int count=1;
-    for(int i=0; i<std::strlen(adcstr); ++i){
-        if('|' == adcstr[i])
-            ++count;
+void DepthMatrix::parse(const hi::FieldView &arr, const IntArray &adColumns){
+
+    this->Values.clear();
+    this->Starts.resize(adColumns.size());
+    this->Counts.resize(adColumns.size());
+    this->Alleles.resize(adColumns.size());
+    this->MaxAlleles = 0;
+    for(std::size_t i=0; i<adColumns.size(); ++i){
+        const hi::FieldRef cell = arr.at(adColumns[i]);
+        this->Starts[i] = this->Values.size();
+
+        // same fields as hi::next_field(): no field after a trailing '|'
+        int num_separators=0;
+        unsigned int value=0;
+        bool isDigitsOnly=true;
+        const char *head = cell.ptr, *end = cell.ptr + cell.len;
+        for(const char *p=head; p!=end; ++p){
+            if('|' == *p){
+                this->Values.push_back(parse_depth(head, p, value, isDigitsOnly));
+                ++num_separators;
+                head = p + 1;
+                value = 0;
+                isDigitsOnly = true;
+                continue;
+            }
+            const unsigned int digit = (unsigned char)(*p) - '0';
+            isDigitsOnly = isDigitsOnly && digit <= 9;
+            value = value*10 + digit;
+        }
+        if(head != end)
+            this->Values.push_back(parse_depth(head, end, value, isDigitsOnly));
+        this->Counts[i] = this->Values.size() - this->Starts[i];
+        this->Alleles[i] = 1 + num_separators;
+        this->MaxAlleles = std::max(this->MaxAlleles, this->Alleles[i]);
     }
-    return count;
+    if(this->Values.empty())
+        this->Values.push_back(0);  // values() always points into the array
 }
 //------------------------------------------------------------------------------
 /**
- * 行全体での対立遺伝子の最大数を求める
- * @param  elements  タブ区切りで行を分解した配列
- * @param  adColumns 調べるカラム（AllelicDepth: "_AD"）の位置
- * @return レコード全体の対立遺伝子の
+ * キャッシュ内のAllelicDepthの表記
+ * 0以上DEPTH_ESCAPE未満の値は16ビット1つ，それ以外はDEPTH_ESCAPEの後に
+ * 32ビットの値を下位・上位の16ビットに分けて続ける
  */
-int get_max_alleles(const hi::StringArray &elements, const IntArray &adColumns){
-    int num_alleles = 0;
-    for(IntArray::const_iterator \
-            pos=adColumns.begin(); pos!=adColumns.end(); ++pos){
+#define DEPTH_ESCAPE 0xFFFF
+
+inline std::size_t encoded_depth_size(const uint16_t *value){
+    return (DEPTH_ESCAPE == *value) ? 3 : 1;
+}
+inline int decode_depth(const uint16_t *value){
+    if(DEPTH_ESCAPE != *value)
+        return *value;
+    return (int)((uint32_t)value[1] | ((uint32_t)value[2] << 16));
+}
+inline void encode_depth(const int value, std::vector<uint16_t> &result){
+    if(0 <= value && DEPTH_ESCAPE > value){
+        result.push_back(value);
+        return;
+    }
+    result.push_back(DEPTH_ESCAPE);
+    result.push_back((uint32_t)value & 0xFFFF);
+    result.push_back((uint32_t)value >> 16);
+}
+//------------------------------------------------------------------------------
+/**
+ * キャッシュに保存した全系統の値から，判定対象の系統の値を取り出す
+ * @param counts      系統毎の値の数（num_columns個）
+ * @param alleles     系統毎の対立遺伝子の数（num_columns個）
+ * @param values      全系統の値をencode_depth()で続けて並べたもの
+ * @param num_columns キャッシュに保存した系統の数
+ * @param index       判定対象の系統のキャッシュ内の番号
+ */
+void DepthMatrix::assign(const uint8_t *counts, const uint8_t *alleles, \
+        const uint16_t *values, const std::size_t num_columns, const IntArray &index){
 
-        num_alleles = std::max(num_alleles, get_num_alleles(elements.at(*pos)));
+    this->Offsets.resize(num_columns);
+    std::size_t offset=0;
+    for(std::size_t i=0; i<num_columns; ++i){
+        this->Offsets[i] = offset;
+        for(std::size_t j=0; j<counts[i]; ++j)
+            offset += encoded_depth_size(values + offset);
     }
 
-    return num_alleles;
- }
- //------------------------------------------------------------------------------
+    this->Values.clear();
+    this->Starts.resize(index.size());
+    this->Counts.resize(index.size());
+    this->Alleles.resize(index.size());
+    this->MaxAlleles = 0;
+    for(std::size_t i=0; i<index.size(); ++i){
+        const uint16_t *head = values + this->Offsets[index[i]];
+        this->Starts[i] = this->Values.size();
+        for(std::size_t j=0; j<counts[index[i]]; ++j){
+            this->Values.push_back(decode_depth(head));
+            head += encoded_depth_size(head);
+        }
+        this->Counts[i] = counts[index[i]];
+        this->Alleles[i] = alleles[index[i]];
+        this->MaxAlleles = std::max(this->MaxAlleles, this->Alleles[i]);
+    }
+    if(this->Values.empty())
+        this->Values.push_back(0);
+}
+//------------------------------------------------------------------------------
 /**
  * ホモ接合にも関わらず検出される対立遺伝子の割合でフィルタリングする
- * @param adepth AllelicDepthの文字列
+ * @param values     AllelicDepthの値
+ * @param num_values 値の数
  * @return MAX_ALT_RATEを超えるリードが存在するか否か
  */
-bool is_pass_alt_rate_filter(const std::string &adepth){
+inline bool is_pass_alt_rate_filter(const int *values, const std::size_t num_values){
 
-    hi::StringArray elements;
-    hi::split(elements, adepth, '|');
-    if(2 < elements.size())
+    if(2 < num_values)
         return false;
 
-    int adepthL = std::atoi(elements[0].c_str());
-    int adepthR = std::atoi(elements[1].c_str());
+    int adepthL = (0 < num_values) ? values[0] : 0;
+    int adepthR = (1 < num_values) ? values[1] : 0;
 
     float adepth1 = (float)std::max(adepthL, adepthR);
     float adepth2 = (float)std::min(adepthL, adepthR);
@@ -271,18 +652,17 @@ bool is_pass_alt_rate_filter(const std::string &adepth){
 //------------------------------------------------------------------------------
 /**
  * ヘテロ接合でリードの比率が1:1から著しく外れたレコードをフィルタリングする
- * @param adepth AllelicDepthの文字列
+ * @param values     AllelicDepthの値
+ * @param num_values 値の数
  * @return MAX_HETERO_BIASを超えるリードが存在するか否か
  */
-bool is_pass_hetero_bias_filter(const std::string &adepth){
+inline bool is_pass_hetero_bias_filter(const int *values, const std::size_t num_values){
 
-    hi::StringArray elements;
-    hi::split(elements, adepth, '|');
-    if(2 < elements.size())
+    if(2 < num_values)
         return false;
 
-    int adepthL = std::atoi(elements[0].c_str());
-    int adepthR = std::atoi(elements[1].c_str());
+    int adepthL = (0 < num_values) ? values[0] : 0;
+    int adepthR = (1 < num_values) ? values[1] : 0;
     float ratio = (float)std::max(adepthL, adepthR) \
             / ((float)std::min(adepthL, adepthR)+0.001);
 
@@ -292,159 +672,325 @@ bool is_pass_hetero_bias_filter(const std::string &adepth){
     return true;
 }
 //------------------------------------------------------------------------------
+// ParsedRecord::fieldFlags
+#define FIELD_11    0x01    // カラムがKEY_11
+#define FIELD_NULL  0x02    // カラムがKEY_NULLまたはKEY_EMPTY
+//------------------------------------------------------------------------------
 /**
- * 系統特異性を判定する（対立遺伝子が2種類のレコードのみを認めるモード)
- * @param elements           タブ区切りで行をパーズした配列
- * @param line               （出力用）パーズ前の行データ
- * @param names              Index->系統名の変換テーブル
- * @param program_name       （出力用）プログラム名
- * @param gtColumns          判定対象のGenotypeカラムの位置
- * @param adColumns          判定対象のAllelicDepthカラムの位置
+ * 1レコード分の作業領域（スレッド毎に1つ使い回す）
+ * テキストから読んだ場合はelementsを，キャッシュから読んだ場合はfieldFlagsを使う
+ */
+struct ParsedRecord{
+    hi::FieldView elements;     // 行をタブ区切りでパーズした配列
+    GenotypeArray genotypes;    // "_GT"カラム
+    CarrierSets carriers;       // genotypesのビット集合
+    DepthMatrix depths;         // "_AD"カラム
+    mutable SpecificityCache specificity;   // 判定結果のメモ（レコードの内容ではない）
+    hi::FieldRef text;          // 出力するレコード（前回の判定結果を除いた元の行）
+    const uint8_t *fieldFlags;  // 先頭から系統数分のカラムのFIELD_*（テキストの場合はNULL）
+
+    /**
+     * index番目のカラム（系統の番号ではなく行の先頭からの位置）が"1|1"か否か
+     * 2アリルモードで"1|1"を背景とした判定の確認に使う
+     */
+    bool is_field_11(const std::size_t index) const {
+        if(NULL != this->fieldFlags)
+            return 0 != (this->fieldFlags[index] & FIELD_11);
+        return index < this->elements.size() && KEY_11==this->elements[index];
+    }
+    /**
+     * index番目のカラム（同上）がKEY_NULLまたはKEY_EMPTYか否か
+     * 多アリルモードで遺伝子型が空のレコードを除くのに使う
+     */
+    bool is_field_null(const std::size_t index) const {
+        if(NULL != this->fieldFlags)
+            return 0 != (this->fieldFlags[index] & FIELD_NULL);
+        return index < this->elements.size() \
+                && (KEY_NULL==this->elements[index] || KEY_EMPTY==this->elements[index]);
+    }
+    ParsedRecord(){
+        this->fieldFlags = NULL;
+    }
+};
+//------------------------------------------------------------------------------
+/**
+ * 2アリルモードの判定のうち，-e/-lだけで決まる部分（-f/-rの値によらない）
+ */
+struct TwoAllelesResult{
+    int specific_column_index;  // 系統特異的でなければ-1
+    int target_allele_pos;      // 変異アリルのAllelicDepth上の位置
+    bool isHeteroBiased;        // 特異的な系統がhetero bias filterを通らない
+    float altLineFrac;          // alt rateを超えたホモ接合系統の割合
+    bool hasTargetDepth;
+    int targetDepth;            // 特異的な系統の変異アリルのリード数
+};
+//------------------------------------------------------------------------------
+/**
+ * 系統特異性を判定し，Alt rate/Read depth filterに使う値を求める
+ * @param record             前処理したレコード
  * @param nHeteroAllowed     許容するヘテロ接合の系統数
- * @param useAltRateFilter   Alt rate filterの適用有無
- * @param maxAltLineFrac     [description]
- * @param useReadDepthFilter Read depth filterの適用有無
- * @param minSupportReads    [description]
- * @param isInvertSelection  系統特異的でないレコードのみを出力する
+ * @param nNullAllowed       許容する遺伝子型不明の系統数
+ * @param useAltRateFilter   Alt rate filterに使う値を求めるか否か
+ * @param useReadDepthFilter Read depth filterに使う値を求めるか否か
+ * @param result             判定結果
  */
-void proc_by_two_alleles_mode(const hi::StringArray &elements, \
-        ColumnToName &names, const std::string &program_name, \
-        const IntArray &gtColumns, const IntArray &adColumns, \
+void evaluate_two_alleles(const ParsedRecord &record, \
         const int *nHeteroAllowed, const int *nNullAllowed, \
-        const bool *useAltRateFilter, const float *maxAltLineFrac, \
-        const bool *useReadDepthFilter, const int *minSupportReads, \
-        const bool *isInvertSelection){
+        const bool useAltRateFilter, const bool useReadDepthFilter, \
+        TwoAllelesResult &result){
 
-    // combine items in the parsed array
-    std::stringstream linestr;
-    for(hi::StringArray::const_iterator \
-            iter=elements.begin(); iter!=elements.end(); ++iter){
+    const GenotypeArray &genotypes = record.genotypes;
+    const DepthMatrix &depths = record.depths;
 
-        linestr << '\t' << *iter;
-    }
-    const std::string line = linestr.str();
+    result.isHeteroBiased = false;
+    result.altLineFrac = 0;
+    result.hasTargetDepth = false;
+    result.targetDepth = 0;
 
     // check line specificity
-    int target_allele_pos=1, specific_column_index;
-    is_line_specific(elements, gtColumns, nHeteroAllowed, nNullAllowed, \
-            KEY_00, &specific_column_index);
+    int &specific_column_index = result.specific_column_index;
+    result.target_allele_pos = 1;
+    record.specificity.is_line_specific(genotypes, record.carriers, \
+            nHeteroAllowed, nNullAllowed, 0, &specific_column_index);
     if(0 > specific_column_index){
         // a line had 0|0 or 0|1 and all others had 1|1
-        is_line_specific(elements, gtColumns, nHeteroAllowed, nNullAllowed, \
-                KEY_11, &specific_column_index);
-        target_allele_pos = 0;
-        if(0 > specific_column_index || KEY_11!=elements[specific_column_index]){
-            if(*isInvertSelection)
-                std::cout << program_name << "\t." << line << ENDL;
+        record.specificity.is_line_specific(genotypes, record.carriers, \
+                nHeteroAllowed, nNullAllowed, 1, &specific_column_index);
+        result.target_allele_pos = 0;
+        if(0 > specific_column_index || ! record.is_field_11(specific_column_index)){
+            specific_column_index = -1;
             return;
         }
     }
-    if(*isInvertSelection)
-        return;
 
     // alt rate filter
-    if(*useAltRateFilter){
-        int alt_rate_exceed=0, hetero_bias_exceed=0;
+    if(useAltRateFilter){
+        int alt_rate_exceed=0;
         int num_homozygous=0;
-        for(int i=0; i<gtColumns.size(); ++i){
-            const bool isHomozygous = is_homozygous(elements[gtColumns.at(i)]);
+        for(int i=0; i<genotypes.size(); ++i){
+            const bool isHomozygous = is_homozygous(genotypes[i]);
             if(i==specific_column_index){
                 if(false==isHomozygous \
-                        && false==is_pass_hetero_bias_filter(elements[adColumns.at(i)])){
+                        && false==is_pass_hetero_bias_filter( \
+                            depths.values(i), depths.num_values(i))){
+                    result.isHeteroBiased = true;
                     return;
                 }
                 continue;
             }
             else if(isHomozygous){
                 ++num_homozygous;
-                if(! is_pass_alt_rate_filter(elements[adColumns.at(i)]))
+                if(! is_pass_alt_rate_filter(depths.values(i), depths.num_values(i)))
                     ++alt_rate_exceed;
             }
         }
-        if(0 < ((float)alt_rate_exceed/(float)num_homozygous) - *maxAltLineFrac)
+        result.altLineFrac = (float)alt_rate_exceed/(float)num_homozygous;
+    }
+
+    // the read depth of a mutant allele
+    if(useReadDepthFilter \
+            && result.target_allele_pos < depths.num_values(specific_column_index)){
+        result.hasTargetDepth = true;
+        result.targetDepth = depths.values(specific_column_index)[result.target_allele_pos];
+    }
+}
+//------------------------------------------------------------------------------
+/**
+ * evaluate_two_alleles()の結果に-f/-rを適用して出力する
+ * @param result             evaluate_two_alleles()の結果
+ * @param record             前処理したレコード（出力には元の行をそのまま使う）
+ * @param names              Index->系統名の変換テーブル
+ * @param program_name       （出力用）プログラム名
+ * @param useAltRateFilter   Alt rate filterの適用有無
+ * @param maxAltLineFrac     alt rateを超えるホモ接合系統の割合の上限
+ * @param useReadDepthFilter Read depth filterの適用有無
+ * @param minSupportReads    変異アリルに必要なリード数
+ * @param isInvertSelection  系統特異的でないレコードのみを出力する
+ * @param output             出力先（hi::OutputWriterまたはhi::OutputBuffer）
+ * @param stats              処理時間・件数の集計
+ */
+template <typename Toutput>
+void output_two_alleles(const TwoAllelesResult &result, \
+        const ParsedRecord &record, \
+        const ColumnToName &names, const std::string &program_name, \
+        const bool *useAltRateFilter, const float *maxAltLineFrac, \
+        const bool *useReadDepthFilter, const int *minSupportReads, \
+        const bool *isInvertSelection, Toutput &output, hi::RunStats &stats){
+
+    const int specific_column_index = result.specific_column_index;
+    if(0 > specific_column_index){
+        stats.count("two_alleles.not_specific");
+        if(*isInvertSelection){
+            stats.enter("output");
+            output << program_name << "\t.\t" << record.text << ENDL;
+            stats.count("records_out");
+            stats.leave();
+        }
+        return;
+    }
+    if(*isInvertSelection){
+        stats.count("two_alleles.specific_inverted");
+        return;
+    }
+
+    // alt rate filter
+    if(*useAltRateFilter){
+        if(result.isHeteroBiased){
+            stats.count("two_alleles.hetero_bias_reject");
             return;
+        }
+        if(0 < result.altLineFrac - *maxAltLineFrac){
+            stats.count("two_alleles.alt_rate_reject");
+            return;
+        }
     }
 
     // filter by the read depth of a mutant allele
-    if(*useReadDepthFilter){
-        hi::StringArray adepth_elements;
-        hi::split(adepth_elements, elements[adColumns.at(specific_column_index)], '|');
-        if(target_allele_pos >= adepth_elements.size() \
-                || std::atoi(adepth_elements.at(target_allele_pos).c_str()) < *minSupportReads)
-            return;
+    if(*useReadDepthFilter \
+            && (! result.hasTargetDepth || result.targetDepth < *minSupportReads)){
+        stats.count("two_alleles.depth_reject");
+        return;
     }
 
     // output
-    ColumnToName::iterator iter = names.find(specific_column_index);
+    stats.count("two_alleles.pass");
+    ColumnToName::const_iterator iter = names.find(specific_column_index);
     if(names.end()!=iter){
-        std::cout << program_name << '\t' << iter->second << line << ENDL;
+        stats.enter("output");
+        output << program_name << '\t' << iter->second << '\t' << record.text << ENDL;
+        stats.count("records_out");
+        stats.leave();
     }
     else{
         std::cerr << ERROR_STRING << "specific_pos=" << specific_column_index \
-                << ", record=" << program_name << '\t' << iter->second << line << ENDL;
+                << ", record=" << program_name << '\t' << record.text << ENDL;
     }
+}
+//------------------------------------------------------------------------------
+/**
+ * 系統特異性を判定する（対立遺伝子が2種類のレコードのみを認めるモード)
+ * @param record             前処理したレコード（出力には元の行をそのまま使う）
+ * @param names              Index->系統名の変換テーブル
+ * @param program_name       （出力用）プログラム名
+ * @param nHeteroAllowed     許容するヘテロ接合の系統数
+ * @param nNullAllowed       許容する遺伝子型不明の系統数
+ * @param useAltRateFilter   Alt rate filterの適用有無
+ * @param maxAltLineFrac     alt rateを超えるホモ接合系統の割合の上限
+ * @param useReadDepthFilter Read depth filterの適用有無
+ * @param minSupportReads    変異アリルに必要なリード数
+ * @param isInvertSelection  系統特異的でないレコードのみを出力する
+ * @param output             出力先（hi::OutputWriterまたはhi::OutputBuffer）
+ * @param stats              処理時間・件数の集計
+ */
+template <typename Toutput>
+void proc_by_two_alleles_mode(const ParsedRecord &record, \
+        const ColumnToName &names, const std::string &program_name, \
+        const int *nHeteroAllowed, const int *nNullAllowed, \
+        const bool *useAltRateFilter, const float *maxAltLineFrac, \
+        const bool *useReadDepthFilter, const int *minSupportReads, \
+        const bool *isInvertSelection, Toutput &output, hi::RunStats &stats){
 
-    return;
+    // the filters aren't needed for the inverted selection
+    TwoAllelesResult result;
+    evaluate_two_alleles(record, nHeteroAllowed, nNullAllowed, \
+            *useAltRateFilter && ! *isInvertSelection, \
+            *useReadDepthFilter && ! *isInvertSelection, result);
+    output_two_alleles(result, record, names, program_name, \
+            useAltRateFilter, maxAltLineFrac, useReadDepthFilter, minSupportReads, \
+            isInvertSelection, output, stats);
 }
 //------------------------------------------------------------------------------
+/**
+ * 指定した対立遺伝子のリード数を取り出す
+ * @param depths DepthMatrix::parse()で変換したAllelicDepth
+ * @param index  系統の位置
+ * @param allele 対立遺伝子の番号（REF=0）
+ * @return リード数
+ */
+int get_allelic_depth(const DepthMatrix &depths, const std::size_t index, const int allele){
+
+    if(0 > allele || depths.num_values(index) <= (std::size_t)allele)
+        throw std::out_of_range("get_allelic_depth()");
+    return depths.values(index)[allele];
+}
+//------------------------------------------------------------------------------
+/**
+ * 多アリルモードで1つの対立遺伝子を持つ系統の集計
+ */
+struct AlleleCarriers{
+    int num_homo, num_hetero;
+    int first_homo_index;   // 最初のホモ接合の系統
+    int first_index;        // 最初の系統（ホモ・ヘテロを問わない）
+};
+//------------------------------------------------------------------------------
 /**
  * 対立遺伝子が3種類以上のレコードを認めるモード（他品種等のリファレンス配列にマッピングした結果に使用）
+ * 全系統を1度だけ走査して対立遺伝子毎の集計を作り，それを対立遺伝子毎に判定する
  * @method proc_by_multiple_alleles_mode
- * @param  file           std::ifstream &file  **ヘッダーは予め飛ばしておくこと**
- * @param  allele_start   alleleカラムの開始位置(左端=0)
- * @param  allele_end     alleleカラムの終了位置の次
+ * @param  record         前処理したレコード（出力には元の行をそのまま使う）
+ * @param  names          Index->系統名の変換テーブル
+ * @param  program_name   （出力用）プログラム名
+ * @param  output         出力先（hi::OutputWriterまたはhi::OutputBuffer）
+ * @param  stats          処理時間・件数の集計
  * @return                処理が成功したか否か
  */
-void proc_by_multiple_alleles_mode(const hi::StringArray &arr, \
-        ColumnToName &names, const std::string &program_name, \
-        const IntArray &gtColumns, const IntArray &adColumns, \
+template <typename Toutput>
+void proc_by_multiple_alleles_mode(const ParsedRecord &record, \
+        const ColumnToName &names, const std::string &program_name, \
         const int *nHeteroAllowed, const int *nNullAllowed, \
-        const bool *isInvertSelection){
+        const bool *isInvertSelection, Toutput &output, hi::RunStats &stats){
+
+    const GenotypeArray &genotypes = record.genotypes;
+    const DepthMatrix &depths = record.depths;
+    const int num_lines = genotypes.size();
 
-    int count, num_homo, num_hetero, specific_column_index, specific_gtype;
-    int num_alleles = get_max_alleles(arr, adColumns);
+    // Genotype::allele[] is a byte, so larger alleles never have a carrier
+    static const AlleleCarriers noCarriers = {0, 0, -1, -1};
+    const int num_alleles = depths.max_alleles();
+    const int num_counted = std::min(num_alleles, UINT8_MAX + 1);
+    AlleleCarriers carriers[UINT8_MAX + 1];
+    for(int gtype=0; gtype<num_counted; ++gtype){
+        carriers[gtype].num_homo = carriers[gtype].num_hetero = 0;
+        carriers[gtype].first_homo_index = carriers[gtype].first_index = -1;
+    }
 
-    // mark homozygous columns in boolean
-    // all others are heterozygous
-    bool *isHomo = new bool [gtColumns.size()];
-    for(int i=0; i<gtColumns.size(); ++i){
+    // count the carriers of every allele in one pass
+    for(int i=0; i<num_lines; ++i){
         // ignore a record with an empty genotype
         // this is usually a result of insufficient depth
-        if(KEY_NULL==arr[i] || KEY_EMPTY==arr[i])
+        if(record.is_field_null(i)){
+            stats.count("multi_alleles.null_genotype");
             return;
-        isHomo[i] = is_homozygous(arr[gtColumns.at(i)]);
-    }
-
-    // combine items in the parsed array
-    std::stringstream linestr;
-    for(hi::StringArray::const_iterator \
-            iter=arr.begin(); iter!=arr.end(); ++iter){
+        }
 
-        linestr << '\t' << *iter;
+        const Genotype &gt = genotypes[i];
+        const bool isHomo = is_homozygous(gt);
+        for(int k=0; k<(isHomo ? 1 : 2); ++k){
+            if(num_counted <= gt.allele[k])
+                continue;
+            AlleleCarriers &carrier = carriers[gt.allele[k]];
+            if(0 > carrier.first_index)
+                carrier.first_index = i;
+            if(isHomo){
+                if(0 == carrier.num_homo)
+                    carrier.first_homo_index = i;
+                ++carrier.num_homo;
+            }
+            else
+                ++carrier.num_hetero;
+        }
     }
-    const std::string line = linestr.str();
 
     // test all possible genotypes
-    char gtchr;
-    hi::StringArray adepth_elements;
+    int num_homo, num_hetero, specific_column_index, specific_gtype;
     for(int gtype=1; gtype<num_alleles; ++gtype){
-        gtchr = char(gtype + 0x30);
-        count = num_homo = num_hetero = 0;
-        specific_column_index = -1;
-
-        for(int i=0; i<gtColumns.size(); ++i){
-            if(gtchr==arr[gtColumns.at(i)][2] || gtchr==arr[gtColumns.at(i)][0]){
-                if(0==num_homo){
-                    specific_column_index = i;
-                    specific_gtype = gtype;
-                }
-
-                if(isHomo[i])
-                    ++num_homo;
-                else
-                    ++num_hetero;
-            }
-        }
+        const AlleleCarriers &carrier = \
+                (gtype < num_counted) ? carriers[gtype] : noCarriers;
+        num_homo = carrier.num_homo;
+        num_hetero = carrier.num_hetero;
+        specific_column_index = \
+                (0 < num_homo) ? carrier.first_homo_index : carrier.first_index;
+        specific_gtype = gtype;
 
         // final decision
         if(0<=specific_column_index &&  \
@@ -454,30 +1000,817 @@ void proc_by_multiple_alleles_mode(const hi::StringArray &arr, \
             /** IMPLEMENT HERE **/
 
             // filter by read depth of the mutant allele
-            adepth_elements.clear();
-            hi::split(adepth_elements, arr[adColumns.at(specific_column_index)], '|');
-            if(MIN_SUPPORT_READS > std::atoi(adepth_elements.at(specific_gtype).c_str()))
+            if(MIN_SUPPORT_READS > get_allelic_depth(depths, specific_column_index, specific_gtype)){
+                stats.count("multi_alleles.depth_reject");
                 continue;
+            }
 
             // output
-            ColumnToName::iterator iter = names.find(specific_column_index);
+            stats.count("multi_alleles.pass");
+            ColumnToName::const_iterator iter = names.find(specific_column_index);
             if(names.end()!=iter){
-                std::cout << program_name << '\t' << iter->second \
-                        <<'\t' << line << ENDL;
+                stats.enter("output");
+                output << program_name << '\t' << iter->second \
+                        << "\t\t" << record.text << ENDL;
+                stats.count("records_out");
+                stats.leave();
             }
             else{
                 std::cerr << ERROR_STRING << "specific_pos=" \
                     << specific_column_index << ", record="  \
-                    << program_name << '\t' << iter->second <<'\t' << line << ENDL;
+                    << program_name << "\t\t" << record.text << ENDL;
             }
         }
-        else if(*isInvertSelection && 0 > specific_column_index)
-            std::cout << program_name << "\t.\t" << line << ENDL;
+        else if(*isInvertSelection && 0 > specific_column_index){
+            stats.enter("output");
+            output << program_name << "\t.\t\t" << record.text << ENDL;
+            stats.count("records_out");
+            stats.leave();
+        }
     }
 
     return;
 }
 // -----------------------------------------------------------------------------
+/**
+ * オプションとヘッダーから決まる判定条件（レコードの処理中は変更しない）
+ */
+struct FilterSettings{
+    ColumnToName names;
+    IntArray gtColumns, adColumns;
+    int posChrom, nHeteroAllowed, nNullAllowed, minSupportReads;
+    float maxAltLineFrac;
+    bool isProgDefined, useAltRateFilter, useReadDepthFilter;
+    bool allowMultipleAlleles, isInvertSelection;
+    int numPatternCache;    // SpecificityCacheの枠の数（0なら使わない）
+};
+// -----------------------------------------------------------------------------
+// 判定に使う対立遺伝子の数（Alt rate filterを使わない場合は常に2）
+inline int get_num_alleles(const ParsedRecord &record, const FilterSettings &settings){
+    return settings.useAltRateFilter ? record.depths.max_alleles() : 2;
+}
+// -----------------------------------------------------------------------------
+/**
+ * 判定の条件によらないレコードの前処理（record.elementsは分割済みであること）
+ * @param record       作業領域．前回の判定結果を取り除き，"_GT"/"_AD"カラムを変換する
+ * @param program_name （出力用）プログラム名．前回の判定結果がある場合は上書きされる
+ * @param settings     判定条件
+ * @param stats        処理時間・件数の集計
+ */
+void prepare_record(ParsedRecord &record, std::string &program_name, \
+        const FilterSettings &settings, hi::RunStats &stats){
+
+    stats.count("records_in");
+
+    // remove decision from previous run
+    if(settings.isProgDefined){
+        record.elements.at(0).assign_to(program_name);
+        record.elements.erase(settings.posChrom);
+    }
+
+    record.text = record.elements.joined();
+    record.fieldFlags = NULL;
+    decode_genotypes(record.elements, settings.gtColumns, record.genotypes);
+    record.carriers.assign(record.genotypes, 0 < settings.numPatternCache);
+    record.depths.parse(record.elements, settings.adColumns);
+}
+//------------------------------------------------------------------------------
+// --build-cache/--cache
+#define CACHE_MAGIC             "GTFCACHE"
+#define CACHE_VERSION           2
+#define NUM_CACHE_BLOCK_RECORDS 65536   // キャッシュの1ブロックのレコード数
+//------------------------------------------------------------------------------
+/**
+ * キャッシュファイルの先頭
+ * ヘッダーの後に"_GT"，"_AD"カラムの位置（int32_t）を並べ，その後にレコードを
+ * NUM_CACHE_BLOCK_RECORDS件毎にカラム別にまとめたブロックを置く
+ * ブロックの位置（CacheBlockの配列）はファイルの末尾（index_offset）に置く
+ */
+struct CacheHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_gt, num_ad;    // "_GT"/"_AD"カラムの数（-xによらず全系統）
+    uint32_t num_blocks;
+    uint64_t num_records;
+    uint64_t source_size;       // 元のテキストファイルの大きさと更新時刻
+    int64_t source_mtime;
+    uint64_t index_offset;
+};
+// キャッシュの1ブロックの位置
+struct CacheBlock{
+    uint64_t offset;
+    uint32_t num_records, num_values;   // num_valuesは"_AD"の値の16ビット単位の長さ
+};
+// 1レコードの元の行での位置（出力には元の行をそのまま使う）
+struct CacheRecord{
+    uint64_t line_offset;       // 行の先頭の位置
+    uint32_t text_offset;       // ParsedRecord::textの行内の位置と長さ
+    uint32_t text_length;
+    uint32_t name_length;       // 前回の判定結果のプログラム名（行の先頭）の長さ
+    uint32_t value_offset;      // ブロック内の"_AD"の値（encode_depth()）の位置
+};
+//------------------------------------------------------------------------------
+// 8バイト境界に揃える
+inline std::size_t align_cache(const std::size_t size){
+    return (size + 7) & ~(std::size_t)7;
+}
+//------------------------------------------------------------------------------
+/**
+ * キャッシュの1ブロック内の各カラムの位置（ブロックの先頭から）
+ * CacheRecord，Genotype，FIELD_*，値の数，対立遺伝子の数，値の順に並べる
+ */
+struct CacheBlockLayout{
+    std::size_t genotypes, flags, counts, alleles, values, size;
+
+    CacheBlockLayout(const CacheHeader &header, const CacheBlock &block){
+        const std::size_t n = block.num_records;
+        this->genotypes = align_cache(n * sizeof(CacheRecord));
+        this->flags = this->genotypes + align_cache(n * header.num_gt * sizeof(Genotype));
+        this->counts = this->flags + align_cache(n * header.num_gt);
+        this->alleles = this->counts + align_cache(n * header.num_ad);
+        this->values = this->alleles + align_cache(n * header.num_ad);
+        this->size = this->values + align_cache(block.num_values * sizeof(uint16_t));
+    }
+};
+//------------------------------------------------------------------------------
+// キャッシュに書き込み，8バイト境界まで0で埋める
+void write_cache(std::ofstream &cache, const void *data, const std::size_t size){
+
+    static const char padding[8] = {0};
+    cache.write(static_cast<const char *>(data), size);
+    cache.write(padding, align_cache(size) - size);
+}
+//------------------------------------------------------------------------------
+/**
+ * 入力の残りのレコードを前処理してキャッシュファイルに書き出す
+ * @param file        入力（ヘッダーは読み終えていること）
+ * @param line_offset 最初のレコードの位置（ヘッダーの大きさ）
+ * @param input_fn    入力ファイル名（大きさと更新時刻を記録する）
+ * @param cache_fn    キャッシュファイル名
+ * @param settings    判定条件．gtColumns/adColumnsには全系統のカラムを指定すること
+ * @param stats       処理時間・件数の集計
+ * @return            書き出せたか否か
+ */
+bool build_genotype_cache(std::istream &file, uint64_t line_offset, \
+        const char *input_fn, const char *cache_fn, \
+        const FilterSettings &settings, hi::RunStats &stats){
+
+    struct stat st;
+    if(0 != stat(input_fn, &st) || ! S_ISREG(st.st_mode))
+        return false;
+    std::ofstream cache(cache_fn, std::ios::binary);
+    if(! cache)
+        return false;
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.num_gt = settings.gtColumns.size();
+    header.num_ad = settings.adColumns.size();
+    header.source_size = st.st_size;
+    header.source_mtime = st.st_mtime;
+    write_cache(cache, &header, sizeof(header));
+
+    std::vector<int32_t> columns(settings.gtColumns.begin(), settings.gtColumns.end());
+    columns.insert(columns.end(), settings.adColumns.begin(), settings.adColumns.end());
+    write_cache(cache, columns.data(), columns.size() * sizeof(int32_t));
+
+    std::vector<CacheBlock> blocks;
+    std::vector<CacheRecord> records;
+    GenotypeArray genotypes;
+    std::vector<uint8_t> flags, counts, alleles;
+    std::vector<uint16_t> values;
+    std::string line, program_name;
+    ParsedRecord record;
+    bool isGood=true;
+    while(true){
+        const bool hasRecord = ! std::getline(file, line).fail();
+        if(hasRecord){
+            record.elements.split(line, '\t');
+            prepare_record(record, program_name, settings, stats);
+
+            CacheRecord entry;
+            entry.line_offset = line_offset;
+            entry.text_offset = 0<record.text.len ? record.text.ptr - line.data() : 0;
+            entry.text_length = record.text.len;
+            entry.name_length = settings.isProgDefined ? program_name.size() : 0;
+            entry.value_offset = values.size();
+            records.push_back(entry);
+            line_offset += line.size() + 1;
+
+            genotypes.insert(genotypes.end(), \
+                    record.genotypes.begin(), record.genotypes.end());
+            for(std::size_t i=0; i<header.num_gt; ++i){
+                uint8_t flag=0;
+                if(i < record.elements.size()){
+                    const hi::FieldRef field = record.elements[i];
+                    if(KEY_11==field)
+                        flag |= FIELD_11;
+                    if(KEY_NULL==field || KEY_EMPTY==field)
+                        flag |= FIELD_NULL;
+                }
+                flags.push_back(flag);
+            }
+            for(std::size_t i=0; i<header.num_ad; ++i){
+                const std::size_t num_values = record.depths.num_values(i);
+                const int num_alleles = record.depths.num_alleles(i);
+                isGood = isGood && num_values <= UINT8_MAX && num_alleles <= UINT8_MAX;
+                counts.push_back(std::min<std::size_t>(num_values, UINT8_MAX));
+                alleles.push_back(std::min(num_alleles, UINT8_MAX));
+                const int *head = record.depths.values(i);
+                for(std::size_t j=0; j<counts.back(); ++j)
+                    encode_depth(head[j], values);
+            }
+        }
+
+        if(NUM_CACHE_BLOCK_RECORDS == records.size() \
+                || (! hasRecord && ! records.empty())){
+
+            CacheBlock block;
+            block.offset = cache.tellp();
+            block.num_records = records.size();
+            block.num_values = values.size();
+            write_cache(cache, records.data(), records.size() * sizeof(CacheRecord));
+            write_cache(cache, genotypes.data(), genotypes.size() * sizeof(Genotype));
+            write_cache(cache, flags.data(), flags.size());
+            write_cache(cache, counts.data(), counts.size());
+            write_cache(cache, alleles.data(), alleles.size());
+            write_cache(cache, values.data(), values.size() * sizeof(uint16_t));
+            blocks.push_back(block);
+            header.num_records += records.size();
+
+            records.clear();
+            genotypes.clear();
+            flags.clear();
+            counts.clear();
+            alleles.clear();
+            values.clear();
+        }
+        if(! hasRecord)
+            break;
+    }
+
+    header.num_blocks = blocks.size();
+    header.index_offset = cache.tellp();
+    write_cache(cache, blocks.data(), blocks.size() * sizeof(CacheBlock));
+    cache.seekp(0);
+    write_cache(cache, &header, sizeof(header));
+    cache.close();
+    return isGood && ! cache.fail();
+}
+//------------------------------------------------------------------------------
+/**
+ * build_genotype_cache()で作ったキャッシュファイルからレコードを読む
+ * キャッシュと元のテキストファイルはmmap()で参照し，出力には元の行をそのまま使う
+ */
+class GenotypeCache{
+public:
+    bool open(const char *cache_fn, const char *input_fn, \
+            const IntArray &gtColumns, const IntArray &adColumns);
+    bool read(ParsedRecord &record, std::string &program_name, \
+            const FilterSettings &settings, hi::RunStats &stats);
+    bool is_open(void) const { return NULL != this->Header; }
+    GenotypeCache();
+
+private:
+    bool validate(void) const;
+    void load_block(const std::size_t index);
+    hi::MappedFile Cache, Text;
+    const CacheHeader *Header;
+    const CacheBlock *Blocks;
+    // 読み込み中のブロック
+    const CacheRecord *Records;
+    const Genotype *Genotypes;
+    const uint8_t *Flags, *Counts, *Alleles;
+    const uint16_t *Values;
+    std::size_t BlockIndex, RecordIndex, NumRecords;
+    // 判定対象の系統のキャッシュ内の番号
+    IntArray GtIndex, AdIndex;
+};
+//------------------------------------------------------------------------------
+GenotypeCache::GenotypeCache(){
+    this->Header = NULL;
+    this->Blocks = NULL;
+    this->BlockIndex = this->RecordIndex = this->NumRecords = 0;
+}
+//------------------------------------------------------------------------------
+// 判定対象のカラムの位置を，キャッシュ内の系統の番号に変換する
+bool map_cache_columns(const int32_t *cached, const std::size_t num_cached, \
+        const IntArray &columns, IntArray &index){
+
+    index.clear();
+    for(IntArray::const_iterator col=columns.begin(); col!=columns.end(); ++col){
+        const int32_t *pos = std::find(cached, cached+num_cached, *col);
+        if(cached+num_cached == pos)
+            return false;
+        index.push_back(pos - cached);
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * キャッシュファイルを開く
+ * @param cache_fn  キャッシュファイル名
+ * @param input_fn  キャッシュを作った入力ファイル名（大きさと更新時刻を確かめる）
+ * @param gtColumns 判定対象の"_GT"カラムの位置
+ * @param adColumns 判定対象の"_AD"カラムの位置
+ * @return          キャッシュが入力ファイルと一致し，壊れていないか否か
+ */
+bool GenotypeCache::open(const char *cache_fn, const char *input_fn, \
+        const IntArray &gtColumns, const IntArray &adColumns){
+
+    this->Header = NULL;
+    struct stat st;
+    if(0 != stat(input_fn, &st) || ! this->Cache.open(cache_fn) \
+            || sizeof(CacheHeader) > this->Cache.size())
+        return false;
+
+    const CacheHeader *header = \
+            reinterpret_cast<const CacheHeader *>(this->Cache.data());
+    const std::size_t szColumns = \
+            align_cache(sizeof(int32_t) * ((std::size_t)header->num_gt + header->num_ad));
+    if(0 != std::memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) \
+            || CACHE_VERSION != header->version \
+            || (uint64_t)st.st_size != header->source_size \
+            || (int64_t)st.st_mtime != header->source_mtime \
+            || align_cache(sizeof(CacheHeader)) + szColumns > this->Cache.size() \
+            || 0 != header->index_offset % 8 \
+            || this->Cache.size() < header->index_offset \
+            || (this->Cache.size() - header->index_offset) / sizeof(CacheBlock) \
+                < header->num_blocks)
+        return false;
+
+    const int32_t *columns = reinterpret_cast<const int32_t *>( \
+            this->Cache.data() + align_cache(sizeof(CacheHeader)));
+    if(! map_cache_columns(columns, header->num_gt, gtColumns, this->GtIndex) \
+            || ! map_cache_columns(columns + header->num_gt, header->num_ad, \
+                adColumns, this->AdIndex) \
+            || ! this->Text.open(input_fn))
+        return false;
+
+    this->Header = header;
+    this->Blocks = reinterpret_cast<const CacheBlock *>( \
+            this->Cache.data() + header->index_offset);
+    if(! this->validate()){
+        this->Header = NULL;
+        return false;
+    }
+    this->BlockIndex = this->RecordIndex = this->NumRecords = 0;
+    return true;
+}
+//------------------------------------------------------------------------------
+// 全てのブロックと行の位置がファイルの範囲内にあるか確かめる（read()では確かめない）
+bool GenotypeCache::validate(void) const{
+
+    const CacheHeader &header = *this->Header;
+    uint64_t num_records=0;
+    for(std::size_t b=0; b<header.num_blocks; ++b){
+        const CacheBlock &block = this->Blocks[b];
+        const CacheBlockLayout layout(header, block);
+        if(0 != block.offset % 8 || this->Cache.size() < block.offset \
+                || this->Cache.size() - block.offset < layout.size)
+            return false;
+
+        const char *data = this->Cache.data() + block.offset;
+        const CacheRecord *records = reinterpret_cast<const CacheRecord *>(data);
+        const uint8_t *counts = reinterpret_cast<const uint8_t *>(data + layout.counts);
+        const uint16_t *values = reinterpret_cast<const uint16_t *>(data + layout.values);
+        for(std::size_t i=0; i<block.num_records; ++i){
+            const CacheRecord &entry = records[i];
+            if(this->Text.size() < entry.line_offset \
+                    || this->Text.size() - entry.line_offset \
+                        < std::max<uint64_t>((uint64_t)entry.text_offset + entry.text_length, \
+                            entry.name_length) \
+                    || block.num_values < entry.value_offset)
+                return false;
+
+            // エスケープした値も含めてブロックの範囲内に収まるか
+            uint64_t pos = entry.value_offset;
+            for(std::size_t j=0; j<header.num_ad; ++j){
+                for(std::size_t k=0; k<counts[i*header.num_ad + j]; ++k){
+                    if(block.num_values <= pos \
+                            || block.num_values - pos < encoded_depth_size(values + pos))
+                        return false;
+                    pos += encoded_depth_size(values + pos);
+                }
+            }
+        }
+        num_records += block.num_records;
+    }
+    return header.num_records == num_records;
+}
+//------------------------------------------------------------------------------
+void GenotypeCache::load_block(const std::size_t index){
+
+    const CacheBlock &block = this->Blocks[index];
+    const CacheBlockLayout layout(*this->Header, block);
+    const char *data = this->Cache.data() + block.offset;
+    this->Records = reinterpret_cast<const CacheRecord *>(data);
+    this->Genotypes = reinterpret_cast<const Genotype *>(data + layout.genotypes);
+    this->Flags = reinterpret_cast<const uint8_t *>(data + layout.flags);
+    this->Counts = reinterpret_cast<const uint8_t *>(data + layout.counts);
+    this->Alleles = reinterpret_cast<const uint8_t *>(data + layout.alleles);
+    this->Values = reinterpret_cast<const uint16_t *>(data + layout.values);
+    this->RecordIndex = 0;
+    this->NumRecords = block.num_records;
+}
+//------------------------------------------------------------------------------
+/**
+ * 次のレコードを読み，prepare_record()と同じ状態にする
+ * @return レコードが残っていたか否か
+ */
+bool GenotypeCache::read(ParsedRecord &record, std::string &program_name, \
+        const FilterSettings &settings, hi::RunStats &stats){
+
+    while(this->NumRecords == this->RecordIndex){
+        if(this->Header->num_blocks <= this->BlockIndex)
+            return false;
+        this->load_block(this->BlockIndex++);
+    }
+    const std::size_t i = this->RecordIndex++;
+    const CacheRecord &entry = this->Records[i];
+    const CacheHeader &header = *this->Header;
+    stats.count("records_in");
+
+    const char *line = this->Text.data() + entry.line_offset;
+    if(settings.isProgDefined)
+        program_name.assign(line, entry.name_length);
+    record.text = hi::FieldRef(line + entry.text_offset, entry.text_length);
+    record.fieldFlags = this->Flags + i*header.num_gt;
+
+    const Genotype *genotypes = this->Genotypes + i*header.num_gt;
+    record.genotypes.resize(this->GtIndex.size());
+    for(std::size_t j=0; j<this->GtIndex.size(); ++j)
+        record.genotypes[j] = genotypes[this->GtIndex[j]];
+    record.carriers.assign(record.genotypes, 0 < settings.numPatternCache);
+
+    record.depths.assign(this->Counts + i*header.num_ad, this->Alleles + i*header.num_ad, \
+            this->Values + entry.value_offset, header.num_ad, this->AdIndex);
+    return true;
+}
+// -----------------------------------------------------------------------------
+/**
+ * 入力のレコードを1件ずつ読んで前処理する
+ * キャッシュを指定した場合はテキストの代わりにキャッシュから読む
+ */
+class RecordReader{
+public:
+    bool read(ParsedRecord &record, std::string &program_name, \
+            const FilterSettings &settings, hi::RunStats &stats){
+
+        if(NULL != this->Cache)
+            return this->Cache->read(record, program_name, settings, stats);
+        if(std::getline(this->File, this->Line).fail())
+            return false;
+        record.elements.split(this->Line, '\t');
+        prepare_record(record, program_name, settings, stats);
+        return true;
+    }
+    RecordReader(std::istream &file, GenotypeCache *cache) : File(file) {
+        this->Cache = cache;
+    }
+
+private:
+    std::istream &File;
+    GenotypeCache *Cache;
+    std::string Line;   // record.elementsが参照する
+};
+// -----------------------------------------------------------------------------
+/**
+ * 入力の残りのレコードを全て判定して出力する
+ * @param inverted         -iで同時に書き出す反転した選択の判定条件（無ければNULL）
+ * @param inverted_output  その出力先
+ * @param inverted_stats   その件数の集計
+ */
+template <typename Toutput>
+void filter_records(RecordReader &reader, std::string &program_name, \
+        const FilterSettings &settings, Toutput &output, hi::RunStats &stats, \
+        const FilterSettings *inverted, Toutput *inverted_output, \
+        hi::RunStats &inverted_stats){
+
+    ParsedRecord record;
+    record.specificity.resize(settings.numPatternCache);
+    while(reader.read(record, program_name, settings, stats)){
+        filter_record(record, program_name, settings, output, stats);
+        if(NULL != inverted)
+            filter_record(record, program_name, *inverted, *inverted_output, inverted_stats);
+    }
+    record.specificity.report(stats);
+}
+// -----------------------------------------------------------------------------
+/**
+ * 1レコードを判定して出力する
+ * @param record       prepare_record()等で前処理したレコード
+ * @param program_name （出力用）プログラム名
+ * @param settings     判定条件
+ * @param output       出力先（hi::OutputWriterまたはhi::OutputBuffer）
+ * @param stats        処理時間・件数の集計
+ */
+template <typename Toutput>
+void filter_record(const ParsedRecord &record, \
+        const std::string &program_name, const FilterSettings &settings, \
+        Toutput &output, hi::RunStats &stats){
+
+    stats.enter("filter");
+    const int num_alleles = get_num_alleles(record, settings);
+    if(2==num_alleles){
+        proc_by_two_alleles_mode( \
+            record, settings.names, program_name, \
+            &settings.nHeteroAllowed, &settings.nNullAllowed, \
+            &settings.useAltRateFilter, &settings.maxAltLineFrac, \
+            &settings.useReadDepthFilter, &settings.minSupportReads, \
+            &settings.isInvertSelection, output, stats);
+    }
+    else if(settings.allowMultipleAlleles && 3<=num_alleles){
+        proc_by_multiple_alleles_mode( \
+            record, settings.names, program_name, \
+            &settings.nHeteroAllowed, &settings.nNullAllowed, \
+            &settings.isInvertSelection, output, stats);
+    }
+    else
+        stats.count("skipped_by_num_alleles");
+    stats.leave();
+}
+// -----------------------------------------------------------------------------
+/**
+ * -tで並列に処理する入力の単位（改行で終わる複数のレコード）
+ */
+struct RecordChunk{
+    std::string data;
+    hi::OutputBuffer output, inverted_output;
+    hi::RunStats stats, inverted_stats;
+    std::future<void> task;
+};
+// -----------------------------------------------------------------------------
+/**
+ * 改行で区切られた入力をSZ_RECORD_CHUNK程度ずつ読み込む
+ * @param file  入力
+ * @param rest  前回の読み込みで残った最終行の断片（次のチャンクの先頭になる）
+ * @param chunk 読み込んだレコード
+ * @return      読み込んだレコードがあるか否か
+ */
+bool read_record_chunk(std::istream &file, std::string &rest, std::string &chunk){
+
+    chunk.swap(rest);
+    rest.clear();
+    while(file){
+        const std::size_t pos = chunk.size();
+        chunk.resize(pos + SZ_RECORD_CHUNK);
+        file.read(&chunk[pos], SZ_RECORD_CHUNK);
+        chunk.resize(pos + file.gcount());
+
+        // keep the incomplete last line for the next chunk
+        const std::size_t eol = chunk.rfind('\n');
+        if(file && std::string::npos != eol){
+            rest.assign(chunk, eol+1, std::string::npos);
+            chunk.resize(eol+1);
+            return true;
+        }
+    }
+    return ! chunk.empty();
+}
+// -----------------------------------------------------------------------------
+/**
+ * チャンク内のレコードを判定する（ワーカースレッドで実行）
+ * std::getline()で1行ずつ読んだ場合と同じ行に分割する
+ * invertedを指定した場合は反転した選択もchunk->inverted_outputに書き出す
+ */
+void filter_chunk(RecordChunk *chunk, const FilterSettings *settings, \
+        const FilterSettings *inverted, const std::string *program_name){
+
+    // one per worker thread, so that the specificity cache outlives a chunk
+    static thread_local ParsedRecord record;
+    record.specificity.resize(settings->numPatternCache);
+    std::string name(*program_name);
+    const char *line = chunk->data.data();
+    const char *end = line + chunk->data.size();
+    while(line < end){
+        const char *eol = static_cast<const char *>(std::memchr(line, '\n', end-line));
+        const std::size_t length = (NULL==eol) ? end-line : eol-line;
+        record.elements.split(line, length, '\t');
+        prepare_record(record, name, *settings, chunk->stats);
+        filter_record(record, name, *settings, chunk->output, chunk->stats);
+        if(NULL != inverted)
+            filter_record(record, name, *inverted, \
+                    chunk->inverted_output, chunk->inverted_stats);
+        line += length + 1;
+    }
+    record.specificity.report(chunk->stats);
+}
+// -----------------------------------------------------------------------------
+/**
+ * チャンクの処理が終わるのを待って結果を書き出し，チャンクを解放する
+ */
+void write_record_chunk(RecordChunk *chunk, hi::OutputWriter &output, \
+        hi::OutputWriter *inverted_output, hi::RunStats &stats, \
+        hi::RunStats &inverted_stats){
+
+    stats.enter("output");
+    chunk->task.get();
+    output.write(chunk->output.data(), chunk->output.size());
+    if(NULL != inverted_output){
+        inverted_output->write( \
+                chunk->inverted_output.data(), chunk->inverted_output.size());
+    }
+    stats.merge(chunk->stats);
+    inverted_stats.merge(chunk->inverted_stats);
+    delete chunk;
+    stats.leave();
+}
+// -----------------------------------------------------------------------------
+/**
+ * -gで指定したパラメータの組み合わせ1つ分
+ */
+struct SweepPoint{
+    int nHeteroAllowed, minSupportReads, nNullAllowed;
+    float maxAltLineFrac;
+    std::size_t evalIndex;      // SweepGrid::resultsの位置（-eと-lの組み合わせ）
+    hi::RunStats stats;         // 件数のみ
+};
+typedef std::vector<SweepPoint> SweepPointArray;
+//------------------------------------------------------------------------------
+/**
+ * パラメータスイープ（-g）の格子
+ * 入力は1度だけ読み，-e/-lの組み合わせ毎に判定した結果に全ての-f/-rを適用する
+ */
+struct SweepGrid{
+    IntArray heteroValues, depthValues, nullValues;     // -e, -r, -l
+    std::vector<float> fracValues;                      // -f
+    SweepPointArray points;
+    std::vector<TwoAllelesResult> results;
+    bool empty(void) const {
+        return heteroValues.empty() && depthValues.empty() \
+                && nullValues.empty() && fracValues.empty();
+    }
+};
+//------------------------------------------------------------------------------
+// 出力を捨てる（-gで件数だけを数える場合）
+struct NullOutput{
+    template <typename Ttype>
+    NullOutput & operator << (const Ttype &){ return *this; }
+};
+//------------------------------------------------------------------------------
+/**
+ * -gの値（"e=0,1,2"など）を格子に加える
+ * @param grid 格子
+ * @param spec パラメータ名（e/r/f/l）と値の一覧
+ * @return     書式が正しいか否か
+ */
+bool add_sweep_values(SweepGrid &grid, const char *spec){
+
+    if(std::strlen(spec) < 3 || '=' != spec[1])
+        return false;
+
+    hi::FieldRef value;
+    const hi::FieldRef values(spec+2, std::strlen(spec+2));
+    for(std::size_t pos=0; hi::next_field(values, ',', &pos, value); ){
+        if(value.empty())
+            return false;
+        switch(spec[0]){
+            case 'e':
+                grid.heteroValues.push_back(value.to_int());
+                break;
+            case 'r':
+                grid.depthValues.push_back(value.to_int());
+                break;
+            case 'l':
+                grid.nullValues.push_back(value.to_int());
+                break;
+            case 'f':
+                grid.fracValues.push_back(value.to_double());
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * 格子の全ての組み合わせを列挙する（-gで指定しなかったパラメータは通常の値を使う）
+ * @param grid     格子
+ * @param settings 判定条件
+ */
+void create_sweep_points(SweepGrid &grid, const FilterSettings &settings){
+
+    if(grid.heteroValues.empty())
+        grid.heteroValues.push_back(settings.nHeteroAllowed);
+    if(grid.depthValues.empty())
+        grid.depthValues.push_back(settings.minSupportReads);
+    if(grid.nullValues.empty())
+        grid.nullValues.push_back(settings.nNullAllowed);
+    if(grid.fracValues.empty())
+        grid.fracValues.push_back(settings.maxAltLineFrac);
+
+    SweepPoint point;
+    point.stats.enable_counters();
+    for(std::size_t e=0; e<grid.heteroValues.size(); ++e){
+        for(std::size_t r=0; r<grid.depthValues.size(); ++r){
+            for(std::size_t f=0; f<grid.fracValues.size(); ++f){
+                for(std::size_t l=0; l<grid.nullValues.size(); ++l){
+                    point.nHeteroAllowed = grid.heteroValues[e];
+                    point.minSupportReads = grid.depthValues[r];
+                    point.maxAltLineFrac = grid.fracValues[f];
+                    point.nNullAllowed = grid.nullValues[l];
+                    point.evalIndex = e*grid.nullValues.size() + l;
+                    grid.points.push_back(point);
+                }
+            }
+        }
+    }
+    grid.results.resize(grid.heteroValues.size() * grid.nullValues.size());
+}
+//------------------------------------------------------------------------------
+/**
+ * 1レコードを格子の全ての組み合わせで判定する
+ * @param record       prepare_record()等で前処理したレコード
+ * @param program_name （出力用）プログラム名
+ * @param settings     -g以外の判定条件
+ * @param grid         格子
+ * @param outputs      組み合わせ毎の出力先（grid.pointsと同じ順）
+ * @param stats        処理時間・件数の集計
+ */
+template <typename Toutput>
+void sweep_record(const ParsedRecord &record, \
+        const std::string &program_name, const FilterSettings &settings, \
+        SweepGrid &grid, std::vector<Toutput *> &outputs, hi::RunStats &stats){
+
+    stats.enter("filter");
+    const int num_alleles = get_num_alleles(record, settings);
+    if(2==num_alleles){
+        // the specificity, alt rate and AD parsing only depend on -e and -l
+        const bool isFiltered = ! settings.isInvertSelection;
+        for(std::size_t e=0; e<grid.heteroValues.size(); ++e){
+            for(std::size_t l=0; l<grid.nullValues.size(); ++l){
+                evaluate_two_alleles(record, &grid.heteroValues[e], &grid.nullValues[l], \
+                        settings.useAltRateFilter && isFiltered, \
+                        settings.useReadDepthFilter && isFiltered, \
+                        grid.results[e*grid.nullValues.size() + l]);
+            }
+        }
+        for(std::size_t i=0; i<grid.points.size(); ++i){
+            SweepPoint &point = grid.points[i];
+            output_two_alleles(grid.results[point.evalIndex], record, \
+                    settings.names, program_name, \
+                    &settings.useAltRateFilter, &point.maxAltLineFrac, \
+                    &settings.useReadDepthFilter, &point.minSupportReads, \
+                    &settings.isInvertSelection, *outputs[i], point.stats);
+        }
+    }
+    else if(settings.allowMultipleAlleles && 3<=num_alleles){
+        for(std::size_t i=0; i<grid.points.size(); ++i){
+            SweepPoint &point = grid.points[i];
+            proc_by_multiple_alleles_mode( \
+                record, settings.names, program_name, \
+                &point.nHeteroAllowed, &point.nNullAllowed, \
+                &settings.isInvertSelection, *outputs[i], point.stats);
+        }
+    }
+    else
+        stats.count("skipped_by_num_alleles");
+    stats.leave();
+}
+//------------------------------------------------------------------------------
+/**
+ * 入力の残りのレコードを全て格子の組み合わせで判定する
+ */
+template <typename Toutput>
+void sweep_records(RecordReader &reader, std::string &program_name, \
+        const FilterSettings &settings, SweepGrid &grid, \
+        std::vector<Toutput *> &outputs, hi::RunStats &stats){
+
+    ParsedRecord record;
+    record.specificity.resize(settings.numPatternCache);
+    while(reader.read(record, program_name, settings, stats))
+        sweep_record(record, program_name, settings, grid, outputs, stats);
+    record.specificity.report(stats);
+}
+//------------------------------------------------------------------------------
+// -oで組み合わせ毎に書き出すファイルの名前
+std::string sweep_output_name(const std::string &prefix, const SweepPoint &point){
+
+    std::ostringstream sstr;
+    sstr << prefix << ".e" << point.nHeteroAllowed << ".r" << point.minSupportReads \
+            << ".f" << point.maxAltLineFrac << ".l" << point.nNullAllowed << ".txt";
+    return sstr.str();
+}
+//------------------------------------------------------------------------------
+/**
+ * 組み合わせ毎に出力されたレコードの数を表にして書き出す
+ */
+void write_sweep_table(const SweepGrid &grid, hi::OutputWriter &output){
+
+    output << "#e\tr\tf\tl\trecords_out" << ENDL;
+    for(SweepPointArray::const_iterator \
+            point=grid.points.begin(); point!=grid.points.end(); ++point){
+
+        output << point->nHeteroAllowed << '\t' << point->minSupportReads << '\t' \
+                << point->maxAltLineFrac << '\t' << point->nNullAllowed << '\t' \
+                << point->stats.counter("records_out") << ENDL;
+    }
+}
+// -----------------------------------------------------------------------------
 bool create_column_to_name(const hi::StringArray &headerElements, \
         const IntArray &gtColumns, const char *keyword, ColumnToName &names){
 
@@ -18,6 +18,11 @@
  */
 
 #include "histd.h"
+#include <zlib.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HI_USE_X86_SIMD
+#endif
 
 namespace HI_NAMESPACE{
 
@@ -28,23 +33,893 @@ void bad_alloc_exception(const char *function){
 	std::exit(EXIT_FAILURE);
 }
 //-----------------------------------------------------------------------------
-char * FileRead(const char *file){
+// number of worker threads used when the caller doesn't specify it
+std::size_t default_threads(void){
+	const std::size_t cores = std::thread::hardware_concurrency();
+	return (0 == cores) ? 1 : std::min<std::size_t>(cores, 4);
+}
+//-----------------------------------------------------------------------------
+MappedFile::MappedFile(){
+	this->Buffer	= NULL;
+	this->Size		= 0;
+	this->szMapped	= 0;
+	this->IsMapped	= false;
+	this->IsCompressed = false;
+}
+//-----------------------------------------------------------------------------
+MappedFile::MappedFile(const char *file){
+	this->Buffer	= NULL;
+	this->Size		= 0;
+	this->szMapped	= 0;
+	this->IsMapped	= false;
+	this->open(file);
+}
+//-----------------------------------------------------------------------------
+MappedFile::~MappedFile(){
+	this->close();
+}
+//-----------------------------------------------------------------------------
+bool MappedFile::open(const char *file){
+
+	this->close();
+
+	// regular uncompressed files are mapped; pipes and gzip/BGZF files are
+	// decompressed into a buffer through InputBuffer
+	if(0 != std::strcmp(file, "-")){
+		int fDesc = ::open(file, O_RDONLY);
+		if(0 > fDesc)
+			return false;
+
+		struct stat st;
+		unsigned char magic[2] = {0, 0};
+		bool isMapped = false;
+		if(0 == fstat(fDesc, &st) && S_ISREG(st.st_mode) && 0 < st.st_size \
+				&& ! (2 == pread(fDesc, magic, 2, 0) && 0x1f == magic[0] && 0x8b == magic[1]))
+			isMapped = this->map_file(fDesc, st.st_size);
+		::close(fDesc);
+		if(isMapped)
+			return true;
+	}
+
+	return this->read_stream(file);
+}
+//-----------------------------------------------------------------------------
+bool MappedFile::map_file(int fDesc, std::size_t size){
+
+	// reserve one more (zero-filled) page so that the data is always
+	// terminated by '\0', then map the file over the head of the region
+	const std::size_t szPage = sysconf(_SC_PAGESIZE);
+	const std::size_t szRegion = (size / szPage + 1) * szPage;
+	void *region = mmap(NULL, szRegion, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(MAP_FAILED == region)
+		return false;
+
+	void *addr = mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fDesc, 0);
+	if(MAP_FAILED == addr){
+		munmap(region, szRegion);
+		return false;
+	}
+	madvise(addr, size, MADV_SEQUENTIAL);
+	madvise(addr, size, MADV_WILLNEED);
+
+	this->Buffer	= static_cast<char *>(addr);
+	this->Size		= size;
+	this->szMapped	= szRegion;
+	this->IsMapped	= true;
+	return true;
+}
+//-----------------------------------------------------------------------------
+bool MappedFile::read_stream(const char *file){
+
+	InputBuffer source;
+	if(! source.open(file))
+		return false;
+
+	const std::size_t szChunk = 1 << 20;
+	std::size_t capacity = szChunk, size = 0;
+	char *buf = static_cast<char *>(std::malloc(capacity+1));
+	if(NULL == buf)
+		return false;
+
+	std::streamsize szRead;
+	while(true){
+		if(capacity == size){
+			capacity *= 2;
+			char *newbuf = static_cast<char *>(std::realloc(buf, capacity+1));
+			if(NULL == newbuf){
+				std::free(buf);
+				return false;
+			}
+			buf = newbuf;
+		}
+		szRead = source.sgetn(buf+size, capacity-size);
+		if(0 >= szRead)
+			break;
+		size += szRead;
+	}
+	buf[size] = '\0';
+
+	this->Buffer	= buf;
+	this->Size		= size;
+	this->szMapped	= 0;
+	this->IsMapped	= false;
+	this->IsCompressed = (InputBuffer::PLAIN != source.format());
+	return true;
+}
+//-----------------------------------------------------------------------------
+bool MappedFile::advise(int advice){
+
+	// e.g. MADV_RANDOM for indexed access; no-op for buffered input
+	if(! this->IsMapped)
+		return false;
+	return (0 == madvise(this->Buffer, this->Size, advice));
+}
+//-----------------------------------------------------------------------------
+void MappedFile::close(void){
+
+	if(NULL == this->Buffer)
+		return;
+
+	if(this->IsMapped)
+		munmap(this->Buffer, this->szMapped);
+	else
+		std::free(this->Buffer);
+
+	this->Buffer	= NULL;
+	this->Size		= 0;
+	this->szMapped	= 0;
+	this->IsMapped	= false;
+	this->IsCompressed = false;
+}
+//-----------------------------------------------------------------------------
+ThreadPool::ThreadPool(std::size_t threads){
+
+	this->IsStopping = false;
+	for(std::size_t i=0; i<std::max<std::size_t>(threads, 1); ++i)
+		this->Workers.push_back(std::thread(&ThreadPool::work, this));
+}
+//-----------------------------------------------------------------------------
+ThreadPool::~ThreadPool(){
+
+	// the queued tasks are finished before the workers exit
+	{
+		std::lock_guard<std::mutex> lock(this->Mutex);
+		this->IsStopping = true;
+	}
+	this->Ready.notify_all();
+	for(std::size_t i=0; i<this->Workers.size(); ++i)
+		this->Workers[i].join();
+}
+//-----------------------------------------------------------------------------
+void ThreadPool::work(void){
+
+	std::function<void()> task;
+	while(true){
+		{
+			std::unique_lock<std::mutex> lock(this->Mutex);
+			while(! this->IsStopping && this->Tasks.empty())
+				this->Ready.wait(lock);
+			if(this->Tasks.empty())
+				return;
+			task = std::move(this->Tasks.front());
+			this->Tasks.pop_front();
+		}
+		task();
+	}
+}
+//-----------------------------------------------------------------------------
+// InputBuffer
+//-----------------------------------------------------------------------------
+static const std::size_t szInputChunk	= 1 << 20;
+static const std::size_t BgzfHeaderSize	= 12;		// fixed part of the gzip header
+static const std::size_t BgzfFooterSize	= 8;		// CRC32 + ISIZE
+static const std::size_t BgzfBlocksPerTask	= 16;	// ~1 MB of output per task
+static const std::size_t BgzfBatchDepth		= 2;	// batches decompressed ahead
+
+static inline uint32_t get_le16(const char *buf){
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(buf);
+	return p[0] | (p[1] << 8);
+}
+static inline uint32_t get_le32(const char *buf){
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(buf);
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+//-----------------------------------------------------------------------------
+// size of the BGZF block from the 'BC' extra subfield (0 if not BGZF)
+static std::size_t bgzf_block_size(const char *header, const char *extra, std::size_t xlen){
+
+	if(0x1f != (unsigned char)header[0] || 0x8b != (unsigned char)header[1] \
+			|| 8 != header[2] || 0 == (header[3] & 4))
+		return 0;
+
+	std::size_t pos=0, slen;
+	while(pos+4 <= xlen){
+		slen = get_le16(extra+pos+2);
+		if('B' == extra[pos] && 'C' == extra[pos+1] && 2 == slen && pos+6 <= xlen)
+			return get_le16(extra+pos+4) + 1;
+		pos += 4 + slen;
+	}
+	return 0;
+}
+//-----------------------------------------------------------------------------
+// decompress the blocks [first, last) of the batch (runs on a worker thread)
+static bool inflate_bgzf_blocks(BgzfBatch *batch, std::size_t first, std::size_t last){
+
+	z_stream zs;
+	std::memset(&zs, 0, sizeof(zs));
+	if(Z_OK != inflateInit2(&zs, -MAX_WBITS))
+		return false;
+
+	bool ret = true;
+	char empty;
+	for(std::size_t i=first; i<last && ret; ++i){
+		const char *block = &batch->input[batch->blocks[i]];
+		const std::size_t szBlock = batch->blocks[i+1] - batch->blocks[i];
+		const std::size_t xlen = get_le16(block+10);
+		const std::size_t szOut = batch->outputs[i+1] - batch->outputs[i];
+		// an empty block (e.g. the EOF marker) may come with an empty output buffer,
+		// but inflate() rejects next_out==NULL
+		char *out = (0 == szOut) ? &empty : batch->output.data() + batch->outputs[i];
+
+		zs.next_in		= reinterpret_cast<Bytef *>(const_cast<char *>(block+BgzfHeaderSize+xlen));
+		zs.avail_in		= szBlock - BgzfHeaderSize - xlen - BgzfFooterSize;
+		zs.next_out		= reinterpret_cast<Bytef *>(out);
+		zs.avail_out	= szOut;
+		ret = (Z_STREAM_END == inflate(&zs, Z_FINISH) && 0 == zs.avail_out \
+				&& crc32(0L, reinterpret_cast<const Bytef *>(out), szOut) \
+					== get_le32(block+szBlock-BgzfFooterSize));
+		inflateReset(&zs);
+	}
+	inflateEnd(&zs);
+	return ret;
+}
+//-----------------------------------------------------------------------------
+InputBuffer::InputBuffer(){
+	this->fDesc		= -1;
+	this->IsStdin	= false;
+	this->Fmt		= PLAIN;
+	this->RawPos	= 0;
+	this->RawEnd	= 0;
+	this->szRead	= 0;
+	this->Zs		= NULL;
+	this->IsStreamEnd	= false;
+	this->Pool		= NULL;
+	this->Current	= NULL;
+}
+//-----------------------------------------------------------------------------
+InputBuffer::~InputBuffer(){
+	this->close();
+}
+//-----------------------------------------------------------------------------
+bool InputBuffer::open(const char *file, std::size_t threads){
+
+	this->close();
+
+	this->IsStdin = (0 == std::strcmp(file, "-"));
+	this->fDesc = this->IsStdin ? STDIN_FILENO : ::open(file, O_RDONLY);
+	if(0 > this->fDesc)
+		return false;
+	this->FileName = file;
+	this->szRead = 0;
+
+	// the format is determined by the magic bytes of the first chunk
+	this->Raw.resize(szInputChunk);
+	this->fill_raw();
+	if(2 <= this->RawEnd && 0x1f == (unsigned char)this->Raw[0] \
+			&& 0x8b == (unsigned char)this->Raw[1]){
+
+		const std::size_t xlen = (BgzfHeaderSize <= this->RawEnd) ? get_le16(&this->Raw[10]) : 0;
+		if(BgzfHeaderSize + xlen <= this->RawEnd \
+				&& 0 < bgzf_block_size(&this->Raw[0], &this->Raw[BgzfHeaderSize], xlen)){
+			this->Fmt = BGZF;
+			this->Pool = new ThreadPool(0 == threads ? default_threads() : threads);
+			for(std::size_t i=0; i<BgzfBatchDepth; ++i)
+				this->submit_batch(new BgzfBatch);
+		}
+		else{
+			this->Fmt = GZIP;
+			this->Zs = new z_stream;
+			std::memset(this->Zs, 0, sizeof(z_stream));
+			if(Z_OK != inflateInit2(this->Zs, MAX_WBITS + 16)){
+				delete this->Zs;
+				this->Zs = NULL;
+				this->close();
+				return false;
+			}
+			this->Zs->next_in	= reinterpret_cast<Bytef *>(&this->Raw[0]);
+			this->Zs->avail_in	= this->RawEnd;
+			this->RawPos = this->RawEnd;
+			this->Out.resize(szInputChunk);
+		}
+	}
+	else
+		this->Fmt = PLAIN;
+
+	this->setg(NULL, NULL, NULL);
+	return true;
+}
+//-----------------------------------------------------------------------------
+void InputBuffer::close(void){
+
+	// the workers may still be writing into the batches
+	delete this->Pool;
+	this->Pool = NULL;
+	for(std::size_t i=0; i<this->Batches.size(); ++i)
+		delete this->Batches[i];
+	this->Batches.clear();
+	delete this->Current;
+	this->Current = NULL;
+
+	if(NULL != this->Zs){
+		inflateEnd(this->Zs);
+		delete this->Zs;
+		this->Zs = NULL;
+	}
+	if(0 <= this->fDesc && ! this->IsStdin)
+		::close(this->fDesc);
+	this->fDesc		= -1;
+	this->Fmt		= PLAIN;
+	this->RawPos	= 0;
+	this->RawEnd	= 0;
+	this->IsStreamEnd	= false;
+	this->setg(NULL, NULL, NULL);
+}
+//-----------------------------------------------------------------------------
+void InputBuffer::corrupted(const char *reason){
+	std::cerr << ERROR_STRING << this->FileName << ": " << reason \
+			<< ". Program execution aborted." << ENDL;
+	std::exit(EXIT_FAILURE);
+}
+//-----------------------------------------------------------------------------
+bool InputBuffer::fill_raw(void){
+
+	ssize_t szRead;
+	do{
+		szRead = ::read(this->fDesc, &this->Raw[0], this->Raw.size());
+	}while(0 > szRead && EINTR == errno);
+	if(0 > szRead)
+		this->corrupted("read error");
+
+	this->RawPos = 0;
+	this->RawEnd = szRead;
+	this->szRead += szRead;
+	return (0 < szRead);
+}
+//-----------------------------------------------------------------------------
+// copy up to size bytes of the raw (still compressed) input
+std::size_t InputBuffer::read_raw(char *buf, std::size_t size){
+
+	std::size_t done=0, szCopy;
+	while(done < size){
+		if(this->RawPos == this->RawEnd && ! this->fill_raw())
+			break;
+		szCopy = std::min(size-done, this->RawEnd-this->RawPos);
+		std::memcpy(buf+done, &this->Raw[this->RawPos], szCopy);
+		this->RawPos += szCopy;
+		done += szCopy;
+	}
+	return done;
+}
+//-----------------------------------------------------------------------------
+InputBuffer::int_type InputBuffer::underflow(void){
+
+	if(this->gptr() < this->egptr())
+		return traits_type::to_int_type(*this->gptr());
+	if(0 > this->fDesc)
+		return traits_type::eof();
+
+	bool hasData;
+	do{
+		switch(this->Fmt){
+			case GZIP:	hasData = this->next_gzip();	break;
+			case BGZF:	hasData = this->next_bgzf();	break;
+			default:	hasData = this->next_plain();	break;
+		}
+		if(! hasData)
+			return traits_type::eof();
+	}while(this->gptr() == this->egptr());
+
+	return traits_type::to_int_type(*this->gptr());
+}
+//-----------------------------------------------------------------------------
+bool InputBuffer::next_plain(void){
+
+	// the raw chunk is handed out as it is
+	if(this->RawPos == this->RawEnd && ! this->fill_raw())
+		return false;
+	char *head = &this->Raw[0];
+	this->setg(head, head+this->RawPos, head+this->RawEnd);
+	this->RawPos = this->RawEnd;
+	return true;
+}
+//-----------------------------------------------------------------------------
+bool InputBuffer::next_gzip(void){
+
+	char *head = &this->Out[0];
+	this->Zs->next_out	= reinterpret_cast<Bytef *>(head);
+	this->Zs->avail_out	= this->Out.size();
+
+	int ret;
+	while(0 < this->Zs->avail_out){
+		if(0 == this->Zs->avail_in){
+			if(! this->fill_raw()){
+				if(! this->IsStreamEnd)
+					this->corrupted("unexpected end of the gzip stream");
+				break;
+			}
+			this->Zs->next_in	= reinterpret_cast<Bytef *>(&this->Raw[0]);
+			this->Zs->avail_in	= this->RawEnd;
+			this->RawPos = this->RawEnd;
+		}
+
+		ret = inflate(this->Zs, Z_NO_FLUSH);
+		if(Z_STREAM_END == ret){
+			// concatenated gzip members are read one after another
+			this->IsStreamEnd = true;
+			inflateReset(this->Zs);
+		}
+		else if(Z_OK == ret)
+			this->IsStreamEnd = false;
+		else if(Z_BUF_ERROR != ret)
+			this->corrupted(NULL == this->Zs->msg ? "broken gzip stream" : this->Zs->msg);
+	}
+
+	const std::size_t size = this->Out.size() - this->Zs->avail_out;
+	this->setg(head, head, head+size);
+	return (0 < size);
+}
+//-----------------------------------------------------------------------------
+bool InputBuffer::read_batch(BgzfBatch &batch){
+
+	const std::size_t maxBlocks = BgzfBlocksPerTask * this->Pool->size();
+	batch.input.clear();
+	batch.blocks.clear();
+	batch.outputs.clear();
+	batch.tasks.clear();
+	batch.blocks.push_back(0);
+	batch.outputs.push_back(0);
+
+	std::size_t head, xlen, szBlock;
+	while(batch.blocks.size() <= maxBlocks){
+		head = batch.input.size();
+		batch.input.resize(head + BgzfHeaderSize);
+		const std::size_t szRead = this->read_raw(&batch.input[head], BgzfHeaderSize);
+		if(0 == szRead){
+			batch.input.resize(head);
+			break;
+		}
+		if(BgzfHeaderSize != szRead)
+			this->corrupted("truncated BGZF block");
+
+		xlen = get_le16(&batch.input[head+10]);
+		batch.input.resize(head + BgzfHeaderSize + xlen);
+		if(xlen != this->read_raw(&batch.input[head+BgzfHeaderSize], xlen))
+			this->corrupted("truncated BGZF block");
+		szBlock = bgzf_block_size(&batch.input[head], &batch.input[head+BgzfHeaderSize], xlen);
+		if(szBlock < BgzfHeaderSize + xlen + BgzfFooterSize)
+			this->corrupted("not a BGZF block");
+
+		batch.input.resize(head + szBlock);
+		const std::size_t szRest = szBlock - BgzfHeaderSize - xlen;
+		if(szRest != this->read_raw(&batch.input[head+BgzfHeaderSize+xlen], szRest))
+			this->corrupted("truncated BGZF block");
+
+		batch.blocks.push_back(head + szBlock);
+		batch.outputs.push_back(batch.outputs.back() \
+				+ get_le32(&batch.input[head+szBlock-4]));
+	}
+
+	return (1 < batch.blocks.size());
+}
+//-----------------------------------------------------------------------------
+void InputBuffer::submit_batch(BgzfBatch *batch){
+
+	if(! this->read_batch(*batch)){
+		delete batch;
+		return;
+	}
+
+	batch->output.resize(batch->outputs.back());
+	const std::size_t szBatch = batch->blocks.size() - 1;
+	for(std::size_t first=0; first<szBatch; first+=BgzfBlocksPerTask){
+		const std::size_t last = std::min(first+BgzfBlocksPerTask, szBatch);
+		batch->tasks.push_back(this->Pool->submit( \
+				std::bind(inflate_bgzf_blocks, batch, first, last)));
+	}
+	this->Batches.push_back(batch);
+}
+//-----------------------------------------------------------------------------
+bool InputBuffer::next_bgzf(void){
+
+	// the consumed batch is refilled and queued again behind the others
+	if(NULL != this->Current){
+		BgzfBatch *batch = this->Current;
+		this->Current = NULL;
+		this->submit_batch(batch);
+	}
+	if(this->Batches.empty())
+		return false;
+
+	this->Current = this->Batches.front();
+	this->Batches.pop_front();
+	for(std::size_t i=0; i<this->Current->tasks.size(); ++i){
+		if(! this->Current->tasks[i].get())
+			this->corrupted("broken BGZF block");
+	}
+
+	char *head = this->Current->output.data();
+	this->setg(head, head, head+this->Current->output.size());
+	return true;
+}
+//-----------------------------------------------------------------------------
+InputStream::InputStream() : std::istream(NULL){
+	this->init(&this->Buffer);
+}
+//-----------------------------------------------------------------------------
+InputStream::InputStream(const char *file, std::size_t threads) : std::istream(NULL){
+	this->init(&this->Buffer);
+	this->open(file, threads);
+}
+//-----------------------------------------------------------------------------
+bool InputStream::open(const char *file, std::size_t threads){
+
+	if(this->Buffer.open(file, threads)){
+		this->clear();
+		return true;
+	}
+	this->setstate(std::ios::failbit);
+	return false;
+}
+//-----------------------------------------------------------------------------
+void InputStream::close(void){
+	this->Buffer.close();
+}
+//-----------------------------------------------------------------------------
+// OutputWriter
+//-----------------------------------------------------------------------------
+static const std::size_t szOutputBuffer = 1 << 20;
+
+OutputWriter::OutputWriter(){
+	this->fDesc		= -1;
+	this->IsStdout	= false;
+	this->Front		= NULL;
+	this->Back		= NULL;
+	this->Capacity	= 0;
+	this->Pos		= 0;
+	this->szBack	= 0;
+	this->szWritten	= 0;
+	this->HasBack	= false;
+	this->IsStopping	= false;
+	this->IsFailed	= false;
+}
+//-----------------------------------------------------------------------------
+OutputWriter::OutputWriter(const char *file){
+	this->fDesc		= -1;
+	this->IsStdout	= false;
+	this->Front		= NULL;
+	this->Back		= NULL;
+	this->Capacity	= 0;
+	this->Pos		= 0;
+	this->szBack	= 0;
+	this->szWritten	= 0;
+	this->HasBack	= false;
+	this->IsStopping	= false;
+	this->IsFailed	= false;
+	this->open(file);
+}
+//-----------------------------------------------------------------------------
+OutputWriter::~OutputWriter(){
+	this->close();
+}
+//-----------------------------------------------------------------------------
+bool OutputWriter::open(const char *file){
+
+	this->close();
+
+	this->IsStdout = (0 == std::strcmp(file, "-"));
+	this->fDesc = this->IsStdout ? STDOUT_FILENO \
+			: ::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(0 > this->fDesc){
+		this->IsFailed = true;
+		return false;
+	}
+
+	try{
+		this->Front	= new char [szOutputBuffer];
+		this->Back	= new char [szOutputBuffer];
+	}
+	catch(std::bad_alloc){
+		bad_alloc_exception("OutputWriter::open()");
+	}
+	this->Capacity	= szOutputBuffer;
+	this->Pos		= 0;
+	this->szWritten	= 0;
+	this->HasBack	= false;
+	this->IsStopping	= false;
+	this->IsFailed	= false;
+
+	// anything already written through std::cout goes out first
+	if(this->IsStdout)
+		std::cout.flush();
+	this->Flusher = std::thread(&OutputWriter::work, this);
+	return true;
+}
+//-----------------------------------------------------------------------------
+bool OutputWriter::close(void){
 
-	int fDesc = open(file, O_RDONLY);
-	if(0 > fDesc)
-		return NULL;
+	if(0 > this->fDesc)
+		return ! this->IsFailed;
 
-	lseek(fDesc, 0, SEEK_SET);
-	long size = lseek(fDesc, 0, SEEK_END);
+	this->flush();
+	{
+		std::unique_lock<std::mutex> lock(this->Mutex);
+		while(this->HasBack)
+			this->Cond.wait(lock);
+		this->IsStopping = true;
+	}
+	this->Cond.notify_all();
+	this->Flusher.join();
 
-	char *buf = new char [size+10];
-	std::memset(buf, '\0', size+10);
+	if(! this->IsStdout && 0 != ::close(this->fDesc))
+		this->IsFailed = true;
+	this->fDesc = -1;
+	delete[] this->Front;
+	delete[] this->Back;
+	this->Front = this->Back = NULL;
+	this->Capacity = this->Pos = 0;
 
-	lseek(fDesc, 0, SEEK_SET);
-	read(fDesc, buf, size);
-	close(fDesc);
+	return ! this->IsFailed;
+}
+//-----------------------------------------------------------------------------
+// hand the filled buffer over to the background thread
+void OutputWriter::flush(void){
+	if(0 < this->Pos)
+		this->swap_buffers();
+}
+//-----------------------------------------------------------------------------
+void OutputWriter::swap_buffers(void){
 
-	return buf;
+	{
+		std::unique_lock<std::mutex> lock(this->Mutex);
+		while(this->HasBack)
+			this->Cond.wait(lock);
+		std::swap(this->Front, this->Back);
+		this->szBack	= this->Pos;
+		this->szWritten	+= this->Pos;
+		this->HasBack	= true;
+	}
+	this->Cond.notify_all();
+	this->Pos = 0;
+}
+//-----------------------------------------------------------------------------
+void OutputWriter::write_large(const char *data, std::size_t size){
+
+	std::size_t szCopy;
+	while(0 < size){
+		if(this->Pos == this->Capacity)
+			this->swap_buffers();
+		szCopy = std::min(size, this->Capacity - this->Pos);
+		std::memcpy(this->Front + this->Pos, data, szCopy);
+		this->Pos += szCopy;
+		data += szCopy;
+		size -= szCopy;
+	}
+}
+//-----------------------------------------------------------------------------
+void OutputWriter::work(void){
+
+	std::size_t done;
+	ssize_t szWritten;
+	while(true){
+		std::unique_lock<std::mutex> lock(this->Mutex);
+		while(! this->HasBack && ! this->IsStopping)
+			this->Cond.wait(lock);
+		if(! this->HasBack)
+			return;
+
+		// the main thread doesn't touch Back until HasBack is cleared
+		lock.unlock();
+		done = 0;
+		while(done < this->szBack && ! this->IsFailed){
+			szWritten = ::write(this->fDesc, this->Back+done, this->szBack-done);
+			if(0 > szWritten && EINTR == errno)
+				continue;
+			if(0 > szWritten)
+				this->IsFailed = true;
+			else
+				done += szWritten;
+		}
+		lock.lock();
+		this->HasBack = false;
+		lock.unlock();
+		this->Cond.notify_all();
+	}
+}
+//-----------------------------------------------------------------------------
+OutputWriter & OutputWriter::write_unsigned(unsigned long long value){
+
+	char buf[24];
+	char *head = buf + sizeof(buf);
+	do{
+		*--head = '0' + (value % 10);
+		value /= 10;
+	}while(0 != value);
+	return this->write(head, buf + sizeof(buf) - head);
+}
+//-----------------------------------------------------------------------------
+OutputWriter & OutputWriter::write_signed(const long long value){
+
+	if(0 <= value)
+		return this->write_unsigned(value);
+	this->put('-');
+	return this->write_unsigned(0ULL - (unsigned long long)value);
+}
+//-----------------------------------------------------------------------------
+OutputWriter & OutputWriter::operator << (const double value){
+
+	// same as the default format of std::ostream (%g, precision 6)
+	char buf[32];
+	const int size = std::snprintf(buf, sizeof(buf), "%g", value);
+	return this->write(buf, std::max(size, 0));
+}
+//-----------------------------------------------------------------------------
+// RunStats
+//-----------------------------------------------------------------------------
+static inline double clock_seconds(clockid_t clock){
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+//-----------------------------------------------------------------------------
+RunStats::RunStats(){
+	this->IsEnabled	= false;
+	this->IsTimed	= false;
+	this->IsJson	= false;
+	this->StartWall	= this->LastWall = 0;
+	this->StartCpu	= this->LastCpu = 0;
+}
+//-----------------------------------------------------------------------------
+/**
+ * 集計を始める
+ * @param format 出力形式（NULLまたは"text"ならkey=value，"json"ならJSON）
+ */
+void RunStats::enable(const char *format){
+	this->IsEnabled	= true;
+	this->IsTimed	= true;
+	this->IsJson	= (NULL != format && 0 == std::strcmp(format, "json"));
+	this->StartWall	= this->LastWall = clock_seconds(CLOCK_MONOTONIC);
+	this->StartCpu	= this->LastCpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+//-----------------------------------------------------------------------------
+/**
+ * 件数だけを集計する（段階の時間は測らない）
+ * ワーカースレッド用．結果はmerge()で本体に加える
+ */
+void RunStats::enable_counters(void){
+	this->IsEnabled	= true;
+	this->IsTimed	= false;
+}
+//-----------------------------------------------------------------------------
+// add the counters of another object (phases are not merged)
+void RunStats::merge(const RunStats &other){
+
+	if(! this->IsEnabled)
+		return;
+	for(std::size_t i=0; i<other.Counters.size(); ++i)
+		this->add_count(other.Counters[i].name, other.Counters[i].value);
+}
+//-----------------------------------------------------------------------------
+// the value of a counter (0 if it has never been counted)
+long long RunStats::counter(const char *name) const{
+
+	for(std::size_t i=0; i<this->Counters.size(); ++i){
+		if(0 == std::strcmp(this->Counters[i].name, name))
+			return this->Counters[i].value;
+	}
+	return 0;
+}
+//-----------------------------------------------------------------------------
+// add the time since the last event to the innermost phase
+void RunStats::accumulate(void){
+
+	const double wall = clock_seconds(CLOCK_MONOTONIC);
+	const double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+	if(! this->Stack.empty()){
+		Phase &phase = this->Phases[this->Stack.back()];
+		phase.wall	+= wall - this->LastWall;
+		phase.cpu	+= cpu - this->LastCpu;
+	}
+	this->LastWall	= wall;
+	this->LastCpu	= cpu;
+}
+//-----------------------------------------------------------------------------
+void RunStats::enter_phase(const char *name){
+
+	this->accumulate();
+
+	// a few phases only; the names are literals, so the pointers usually match
+	std::size_t id=0;
+	while(id < this->Phases.size() && this->Phases[id].name != name \
+			&& 0 != std::strcmp(this->Phases[id].name, name))
+		++id;
+	if(id == this->Phases.size()){
+		Phase phase = {name, 0, 0, 0};
+		this->Phases.push_back(phase);
+	}
+	++this->Phases[id].calls;
+	this->Stack.push_back(id);
+}
+//-----------------------------------------------------------------------------
+void RunStats::leave_phase(void){
+
+	if(this->Stack.empty())
+		return;
+	this->accumulate();
+	this->Stack.pop_back();
+}
+//-----------------------------------------------------------------------------
+void RunStats::add_count(const char *name, const long long num){
+
+	std::size_t id=0;
+	while(id < this->Counters.size() && this->Counters[id].name != name \
+			&& 0 != std::strcmp(this->Counters[id].name, name))
+		++id;
+	if(id == this->Counters.size()){
+		Counter counter = {name, 0};
+		this->Counters.push_back(counter);
+	}
+	this->Counters[id].value += num;
+}
+//-----------------------------------------------------------------------------
+/**
+ * 集計結果を標準エラー出力に書き出す
+ * 時間は秒，最大RSSはKB．どの段階にも含まれない時間はtotalとの差になる
+ */
+void RunStats::report(const char *program){
+
+	if(! this->IsEnabled)
+		return;
+	this->accumulate();
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	const double wall = this->LastWall - this->StartWall;
+	const double cpu = this->LastCpu - this->StartCpu;
+
+	std::ostringstream ost;
+	if(this->IsJson){
+		ost << "{\"program\": \"" << program << "\", \"wall_sec\": " << wall \
+				<< ", \"cpu_sec\": " << cpu << ", \"peak_rss_kb\": " << usage.ru_maxrss \
+				<< ", \"phases\": {";
+		for(std::size_t i=0; i<this->Phases.size(); ++i){
+			const Phase &phase = this->Phases[i];
+			ost << (0<i ? ", " : "") << '"' << phase.name << "\": {\"wall_sec\": " << phase.wall \
+					<< ", \"cpu_sec\": " << phase.cpu << ", \"calls\": " << phase.calls << '}';
+		}
+		ost << "}, \"counters\": {";
+		for(std::size_t i=0; i<this->Counters.size(); ++i){
+			ost << (0<i ? ", " : "") << '"' << this->Counters[i].name << "\": " \
+					<< this->Counters[i].value;
+		}
+		ost << "}}" << ENDL;
+	}
+	else{
+		ost << "stats.program=" << program << ENDL \
+				<< "stats.wall_sec=" << wall << ENDL \
+				<< "stats.cpu_sec=" << cpu << ENDL \
+				<< "stats.peak_rss_kb=" << usage.ru_maxrss << ENDL;
+		for(std::size_t i=0; i<this->Phases.size(); ++i){
+			const Phase &phase = this->Phases[i];
+			ost << "stats.phase." << phase.name << ".wall_sec=" << phase.wall << ENDL \
+					<< "stats.phase." << phase.name << ".cpu_sec=" << phase.cpu << ENDL \
+					<< "stats.phase." << phase.name << ".calls=" << phase.calls << ENDL;
+		}
+		for(std::size_t i=0; i<this->Counters.size(); ++i){
+			ost << "stats.count." << this->Counters[i].name << '=' \
+					<< this->Counters[i].value << ENDL;
+		}
+	}
+	std::cerr << ost.str();
 }
 //-----------------------------------------------------------------------------
 bool split(StringArray &result, const std::string line, const char delimiter){
@@ -81,26 +956,197 @@ bool split(StringArray &result, const char *line, const char *delim){
 	return true;
 }
 //-----------------------------------------------------------------------------
+bool next_field(const FieldRef &source, const char delimiter, \
+		std::size_t *pos, FieldRef &result){
+
+	if(*pos >= source.len)
+		return false;
+
+	const char *head = source.ptr + *pos;
+	const char *hit = static_cast<const char *>( \
+			std::memchr(head, delimiter, source.len - *pos));
+	if(NULL == hit){
+		result = FieldRef(head, source.len - *pos);
+		*pos = source.len;
+	}
+	else{
+		result = FieldRef(head, hit - head);
+		*pos += (hit - head) + 1;
+	}
+	return true;
+}
+//-----------------------------------------------------------------------------
+std::size_t split_int(const FieldRef &source, const char delimiter, \
+		int *values, const std::size_t max_values){
+
+	std::size_t pos=0, count=0;
+	FieldRef element;
+	while(next_field(source, delimiter, &pos, element)){
+		if(count < max_values)
+			values[count] = element.to_int();
+		++count;
+	}
+	return count;
+}
+//-----------------------------------------------------------------------------
+std::size_t FieldRef::find(const char chr, std::size_t pos) const{
+
+	if(pos >= this->len)
+		return std::string::npos;
+	const char *hit = static_cast<const char *>( \
+			std::memchr(this->ptr+pos, chr, this->len-pos));
+	if(NULL == hit)
+		return std::string::npos;
+	return hit - this->ptr;
+}
+//-----------------------------------------------------------------------------
+std::size_t FieldRef::find(const char *word, std::size_t pos) const{
+
+	const std::size_t szWord = std::strlen(word);
+	if(0 == szWord)
+		return (pos<=this->len) ? pos : std::string::npos;
+
+	while(pos+szWord <= this->len){
+		pos = this->find(word[0], pos);
+		if(std::string::npos == pos || pos+szWord > this->len)
+			return std::string::npos;
+		if(0 == std::memcmp(this->ptr+pos, word, szWord))
+			return pos;
+		++pos;
+	}
+	return std::string::npos;
+}
+//-----------------------------------------------------------------------------
+std::size_t FieldRef::count(const char chr) const{
+
+	std::size_t count=0;
+	for(std::size_t pos=0; pos<this->len; ++pos){
+		if(chr == this->ptr[pos])
+			++count;
+	}
+	return count;
+}
+//-----------------------------------------------------------------------------
+int FieldRef::to_int(void) const{
+
+	// atoi()と同じ結果を返す（数値として意味のある桁数のみコピーする）
+	char buf[32];
+	const std::size_t size = std::min(this->len, sizeof(buf)-1);
+	std::memcpy(buf, this->ptr, size);
+	buf[size] = '\0';
+	return std::atoi(buf);
+}
+//-----------------------------------------------------------------------------
+double FieldRef::to_double(void) const{
+
+	char buf[64];
+	const std::size_t size = std::min(this->len, sizeof(buf)-1);
+	std::memcpy(buf, this->ptr, size);
+	buf[size] = '\0';
+	return std::atof(buf);
+}
+//-----------------------------------------------------------------------------
+bool operator == (const FieldRef &a, const char *b){
+	return a.equals(b, std::strlen(b));
+}
+//-----------------------------------------------------------------------------
+bool operator == (const FieldRef &a, const std::string &b){
+	return a.equals(b.data(), b.length());
+}
+//-----------------------------------------------------------------------------
+bool operator == (const FieldRef &a, const FieldRef &b){
+	return a.equals(b.ptr, b.len);
+}
+//-----------------------------------------------------------------------------
+std::ostream & operator << (std::ostream &ost, const FieldRef &field){
+
+	// std::stringと同様にsetw()/setfill()を反映する
+	const std::streamsize width = ost.width();
+	if(width > (std::streamsize)field.len){
+		const std::size_t szPad = width - field.len;
+		const bool isLeft = (std::ios::left == (ost.flags() & std::ios::adjustfield));
+		if(! isLeft){
+			for(std::size_t i=0; i<szPad; ++i)
+				ost.put(ost.fill());
+		}
+		ost.write(field.ptr, field.len);
+		if(isLeft){
+			for(std::size_t i=0; i<szPad; ++i)
+				ost.put(ost.fill());
+		}
+	}
+	else
+		ost.write(field.ptr, field.len);
+	ost.width(0);
+
+	return ost;
+}
+//-----------------------------------------------------------------------------
+FieldView::FieldView(){
+	this->Line = "";
+}
+//-----------------------------------------------------------------------------
+std::size_t FieldView::split(const char *line, std::size_t length, const char delimiter){
+
+	this->Line = line;
+	this->Spans.clear();
+
+	FieldRef source(line, length), element;
+	FieldSpan span;
+	std::size_t pos=0;
+	while(next_field(source, delimiter, &pos, element)){
+		span.offset = element.ptr - line;
+		span.length = element.len;
+		this->Spans.push_back(span);
+	}
+	return this->Spans.size();
+}
+//-----------------------------------------------------------------------------
+std::size_t FieldView::split(const std::string &line, const char delimiter){
+	return this->split(line.c_str(), line.length(), delimiter);
+}
+//-----------------------------------------------------------------------------
+std::size_t FieldView::split(const FieldRef &line, const char delimiter){
+	return this->split(line.ptr, line.len, delimiter);
+}
+//-----------------------------------------------------------------------------
+void FieldView::erase(std::size_t num_fields){
+	num_fields = std::min(num_fields, this->Spans.size());
+	this->Spans.erase(this->Spans.begin(), this->Spans.begin()+num_fields);
+}
+//-----------------------------------------------------------------------------
+/**
+ * 残っている要素をタブ等で連結したものと同じ範囲を元の行の上で返す
+ * （erase()した先頭の要素と末尾の区切り文字は含まない．コピーは作らない）
+ */
+FieldRef FieldView::joined(void) const{
+	if(this->Spans.empty())
+		return FieldRef();
+	const FieldSpan &first = this->Spans.front(), &last = this->Spans.back();
+	return FieldRef(this->Line+first.offset, last.offset+last.length-first.offset);
+}
+//-----------------------------------------------------------------------------
+FieldRef FieldView::at(std::size_t index) const{
+	if(index >= this->Spans.size())
+		throw std::out_of_range("hi::FieldView::at()");
+	return (*this)[index];
+}
+//-----------------------------------------------------------------------------
 RETVAL rmspace(char *seq){
 
 	size_t size = std::strlen(seq);
 	if(0 == size)
 		return RV_FALSE;
 
-	char *newseq = new char [size+1];
-	std::memset(newseq, '\0', size+1);
-
+	// compaction in place (the write position never passes the read position)
 	size_t newpos=0;
 	for(size_t pos=0; pos<size; pos++){
 		if(0 != std::isalpha(seq[pos])){
-			newseq[newpos] = seq[pos];
+			seq[newpos] = seq[pos];
 			++newpos;
 		}
 	}
-
-	std::memset(seq, '\0', size);
-	std::strncpy(seq, newseq, newpos);
-	delete[] newseq;
+	std::memset(seq+newpos, '\0', size-newpos);
 
 	return RV_TRUE;
 }
@@ -119,4 +1165,148 @@ size_t pos=0;
     return pos;
 }
 //-----------------------------------------------------------------------------
+// clean_upper(): rmspace() + toupper() in a single pass
+// dest may be the same buffer as src (the write position never passes the
+// read position)
+//-----------------------------------------------------------------------------
+typedef std::size_t (*CleanUpperKernel)(const char *, std::size_t, char *);
+//-----------------------------------------------------------------------------
+static std::size_t clean_upper_scalar(const char *src, std::size_t size, char *dest){
+
+	std::size_t out=0;
+	unsigned char chr;
+	for(std::size_t in=0; in<size; ++in){
+		chr = src[in];
+		if(static_cast<unsigned char>((chr | 0x20) - 'a') < 26)
+			dest[out++] = ('a'<=chr && 'z'>=chr) ? chr - 0x20 : chr;
+	}
+	return out;
+}
+//-----------------------------------------------------------------------------
+#ifdef HI_USE_X86_SIMD
+// pshufb patterns that pack the selected bytes of an 8-byte block to the front
+struct CompactTable{
+	uint8_t shuffle[256][8];
+	uint8_t count[256];
+	CompactTable(){
+		for(int mask=0; mask<256; ++mask){
+			int k=0;
+			for(int i=0; i<8; ++i){
+				if(mask & (1<<i))
+					shuffle[mask][k++] = i;
+			}
+			count[mask] = k;
+			for(; k<8; ++k)
+				shuffle[mask][k] = 0x80;
+		}
+	}
+};
+static const CompactTable CompactPatterns;
+//-----------------------------------------------------------------------------
+// the 16 bytes at src+in are already loaded, so the stores never pass them
+__attribute__((target("sse4.2")))
+static inline std::size_t compact_16(char *dest, std::size_t out, \
+		__m128i block, unsigned int mask){
+
+	const unsigned int lo = mask & 0xFF, hi = (mask >> 8) & 0xFF;
+	__m128i pattern = _mm_loadl_epi64( \
+			reinterpret_cast<const __m128i *>(CompactPatterns.shuffle[lo]));
+	_mm_storel_epi64(reinterpret_cast<__m128i *>(dest+out), _mm_shuffle_epi8(block, pattern));
+	out += CompactPatterns.count[lo];
+
+	pattern = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(CompactPatterns.shuffle[hi]));
+	_mm_storel_epi64(reinterpret_cast<__m128i *>(dest+out), \
+			_mm_shuffle_epi8(_mm_srli_si128(block, 8), pattern));
+	out += CompactPatterns.count[hi];
+
+	return out;
+}
+//-----------------------------------------------------------------------------
+__attribute__((target("sse4.2")))
+static std::size_t clean_upper_sse42(const char *src, std::size_t size, char *dest){
+
+	const __m128i lowerA = _mm_set1_epi8('a'-1), lowerZ = _mm_set1_epi8('z'+1);
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	std::size_t in=0, out=0;
+	__m128i block, folded, isAlpha, isLower;
+	unsigned int mask;
+	for(; in+16<=size; in+=16){
+		block   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src+in));
+		folded  = _mm_or_si128(block, caseBit);
+		isAlpha = _mm_and_si128(_mm_cmpgt_epi8(folded, lowerA), _mm_cmplt_epi8(folded, lowerZ));
+		isLower = _mm_and_si128(_mm_cmpgt_epi8(block, lowerA), _mm_cmplt_epi8(block, lowerZ));
+		block   = _mm_xor_si128(block, _mm_and_si128(isLower, caseBit));
+		mask    = _mm_movemask_epi8(isAlpha);
+		if(0xFFFF == mask){
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dest+out), block);
+			out += 16;
+		}
+		else if(0 != mask)
+			out = compact_16(dest, out, block, mask);
+	}
+	return out + clean_upper_scalar(src+in, size-in, dest+out);
+}
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static std::size_t clean_upper_avx2(const char *src, std::size_t size, char *dest){
+
+	const __m256i lowerA = _mm256_set1_epi8('a'-1), lowerZ = _mm256_set1_epi8('z'+1);
+	const __m256i caseBit = _mm256_set1_epi8(0x20);
+	std::size_t in=0, out=0;
+	__m256i block, folded, isAlpha, isLower;
+	unsigned int mask;
+	for(; in+32<=size; in+=32){
+		block   = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src+in));
+		folded  = _mm256_or_si256(block, caseBit);
+		isAlpha = _mm256_and_si256(_mm256_cmpgt_epi8(folded, lowerA), \
+				_mm256_cmpgt_epi8(lowerZ, folded));
+		isLower = _mm256_and_si256(_mm256_cmpgt_epi8(block, lowerA), \
+				_mm256_cmpgt_epi8(lowerZ, block));
+		block   = _mm256_xor_si256(block, _mm256_and_si256(isLower, caseBit));
+		mask    = _mm256_movemask_epi8(isAlpha);
+		if(0xFFFFFFFF == mask){
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(dest+out), block);
+			out += 32;
+		}
+		else if(0 != mask){
+			out = compact_16(dest, out, _mm256_castsi256_si128(block), mask & 0xFFFF);
+			out = compact_16(dest, out, _mm256_extracti128_si256(block, 1), mask >> 16);
+		}
+	}
+	return out + clean_upper_scalar(src+in, size-in, dest+out);
+}
+#endif
+//-----------------------------------------------------------------------------
+static CleanUpperKernel select_clean_upper_kernel(void){
+#ifdef HI_USE_X86_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return clean_upper_avx2;
+	if(__builtin_cpu_supports("sse4.2"))
+		return clean_upper_sse42;
+#endif
+	return clean_upper_scalar;
+}
+//-----------------------------------------------------------------------------
+/**
+ * アルファベット以外の文字を取り除き，大文字に変換する（rmspace() + toupper()）
+ * AVX2/SSE4.2は実行時に判定して使用する
+ * @param src  元の配列
+ * @param size 元の配列の長さ
+ * @param dest 出力先（size+1バイト以上．srcと同じバッファでもよい）
+ * @return 処理後の長さ（dest[return]に'\0'を書き込む．それ以降の内容は不定）
+ */
+std::size_t clean_upper(const char *src, std::size_t size, char *dest){
+
+	static const CleanUpperKernel kernel = select_clean_upper_kernel();
+	const std::size_t newsize = kernel(src, size, dest);
+	dest[newsize] = '\0';
+	return newsize;
+}
+//-----------------------------------------------------------------------------
+// in-place version: no buffer is allocated
+std::size_t clean_upper(char *seq, std::size_t size){
+	return clean_upper(seq, size, seq);
+}
+//-----------------------------------------------------------------------------
 }	// End of namespace
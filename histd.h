@@ -22,15 +22,35 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 #include <sstream>
 #include <string>
 #include <cstring>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <stdexcept>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <stdint.h>
+#include <istream>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <type_traits>
+#include <atomic>
+#include <getopt.h>
+#include <sys/resource.h>
+
+struct z_stream_s;
 
 // constants
 #define ENDL        '\n'
@@ -53,13 +73,384 @@ namespace HI_NAMESPACE{
     typedef std::vector<int> IntArray;
 	typedef std::vector<double> DoubleArray;
 
+    //-------------------------------------------------------------------------
+    /**
+     * 行バッファ中の1要素を指す参照（コピーを作らない）
+     * 元のバッファが有効な間のみ使用できる
+     */
+    struct FieldRef{
+        const char *ptr;
+        std::size_t len;
+        FieldRef(){
+            ptr = "";
+            len = 0;
+        }
+        FieldRef(const char *p, std::size_t n){
+            ptr = p;
+            len = n;
+        }
+        std::size_t length(void) const { return len; }
+        std::size_t size(void) const { return len; }
+        bool empty(void) const { return 0==len; }
+        const char * data(void) const { return ptr; }
+        // 範囲外は'\0'を返す
+        char operator [] (std::size_t pos) const { return (pos<len) ? ptr[pos] : '\0'; }
+        std::string str(void) const { return std::string(ptr, len); }
+        void assign_to(std::string &result) const { result.assign(ptr, len); }
+        bool equals(const char *word, std::size_t szWord) const {
+            return (szWord==len && 0==std::memcmp(ptr, word, len));
+        }
+        bool starts_with(const char *word) const {
+            const std::size_t szWord = std::strlen(word);
+            return (szWord<=len && 0==std::memcmp(ptr, word, szWord));
+        }
+        FieldRef substr(std::size_t pos, std::size_t n=std::string::npos) const {
+            if(pos > len)
+                pos = len;
+            return FieldRef(ptr+pos, std::min(n, len-pos));
+        }
+        std::size_t find(const char chr, std::size_t pos=0) const;
+        std::size_t find(const char *word, std::size_t pos=0) const;
+        std::size_t count(const char chr) const;
+        int to_int(void) const;
+        double to_double(void) const;
+    };
+    bool operator == (const FieldRef &a, const char *b);
+    bool operator == (const FieldRef &a, const std::string &b);
+    bool operator == (const FieldRef &a, const FieldRef &b);
+    inline bool operator == (const char *a, const FieldRef &b){ return b==a; }
+    inline bool operator == (const std::string &a, const FieldRef &b){ return b==a; }
+    inline bool operator != (const FieldRef &a, const char *b){ return !(a==b); }
+    inline bool operator != (const FieldRef &a, const std::string &b){ return !(a==b); }
+    inline bool operator != (const FieldRef &a, const FieldRef &b){ return !(a==b); }
+    inline bool operator != (const char *a, const FieldRef &b){ return !(b==a); }
+    inline bool operator != (const std::string &a, const FieldRef &b){ return !(b==a); }
+    std::ostream & operator << (std::ostream &ost, const FieldRef &field);
+
+    //-------------------------------------------------------------------------
+    // (offset, length)
+    struct FieldSpan{
+        std::size_t offset, length;
+    };
+    typedef std::vector<FieldSpan> FieldSpanArray;
+
+    /**
+     * 行を区切り文字で分割し，元のバッファ上の位置だけを記録する
+     * split(StringArray&, std::string, char)と同じ規則で分割する
+     * （連続する区切り文字は空の要素，末尾の区切り文字は無視）
+     * 同じオブジェクトを使い回せばレコード毎のメモリ割り当ては発生しない
+     */
+    class FieldView{
+    public:
+        std::size_t split(const char *line, std::size_t length, const char delimiter);
+        std::size_t split(const std::string &line, const char delimiter);
+        std::size_t split(const FieldRef &line, const char delimiter);
+        void erase(std::size_t num_fields);
+        void clear(void){ this->Spans.clear(); }
+        std::size_t size(void) const { return this->Spans.size(); }
+        bool empty(void) const { return this->Spans.empty(); }
+        FieldRef operator [] (std::size_t index) const {
+            return FieldRef(this->Line+this->Spans[index].offset, this->Spans[index].length);
+        }
+        FieldRef at(std::size_t index) const;
+        FieldRef joined(void) const;
+        std::size_t offset(std::size_t index) const { return this->Spans[index].offset; }
+        FieldView();
+
+    private:
+        const char *Line;
+        FieldSpanArray Spans;
+    };
+
+    //-------------------------------------------------------------------------
+    /**
+     * 入力ファイル全体を読み取り専用で参照する
+     * 通常のファイルはmmap()で割り当て（コピーなし），パイプ等はread()で分割して読み込む
+     * data()[size()]は常に'\0'なので，C文字列として走査してもよい
+     * "-"を指定すると標準入力から読み込む
+     */
+    class MappedFile{
+    public:
+        bool open(const char *file);
+        void close(void);
+        const char * data(void) const { return this->Buffer; }
+        std::size_t size(void) const { return this->Size; }
+        bool is_open(void) const { return NULL != this->Buffer; }
+        bool is_mapped(void) const { return this->IsMapped; }
+        bool is_compressed(void) const { return this->IsCompressed; }
+        bool advise(int advice);
+        MappedFile();
+        MappedFile(const char *file);
+        ~MappedFile();
+
+    private:
+        MappedFile(const MappedFile &);
+        MappedFile & operator = (const MappedFile &);
+        bool map_file(int fDesc, std::size_t size);
+        bool read_stream(const char *file);
+        char *Buffer;
+        std::size_t Size, szMapped;
+        bool IsMapped, IsCompressed;
+    };
+
+    //-------------------------------------------------------------------------
+    /**
+     * 固定数のワーカースレッドでタスクを順に処理する
+     * submit()の戻り値（std::future）でタスクの終了と結果を受け取る
+     */
+    class ThreadPool{
+    public:
+        template <typename Tfunc>
+        std::future<typename std::result_of<Tfunc()>::type> submit(Tfunc func){
+            typedef typename std::result_of<Tfunc()>::type Tresult;
+            std::shared_ptr< std::packaged_task<Tresult()> > task = \
+                    std::make_shared< std::packaged_task<Tresult()> >(func);
+            std::future<Tresult> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(this->Mutex);
+                this->Tasks.push_back([task](){ (*task)(); });
+            }
+            this->Ready.notify_one();
+            return result;
+        }
+        std::size_t size(void) const { return this->Workers.size(); }
+        explicit ThreadPool(std::size_t threads);
+        ~ThreadPool();
+
+    private:
+        ThreadPool(const ThreadPool &);
+        ThreadPool & operator = (const ThreadPool &);
+        void work(void);
+        std::vector<std::thread> Workers;
+        std::deque< std::function<void()> > Tasks;
+        std::mutex Mutex;
+        std::condition_variable Ready;
+        bool IsStopping;
+    };
+
+    // BGZFブロックをまとめて展開する単位
+    struct BgzfBatch{
+        std::vector<char> input;
+        SzArray blocks;         // inputにおける各ブロックの開始位置（末尾を含む）
+        SzArray outputs;        // outputにおける各ブロックの開始位置（末尾を含む）
+        std::vector<char> output;
+        std::vector< std::future<bool> > tasks;
+    };
+
+    /**
+     * 非圧縮/gzip/BGZFを先頭のマジックバイトで判別して読み込むstreambuf
+     * BGZFはブロック単位でスレッドプールに展開させ，読み込みと並行して先読みする
+     */
+    class InputBuffer : public std::streambuf{
+    public:
+        enum Format{ PLAIN, GZIP, BGZF };
+        bool open(const char *file, std::size_t threads=0);
+        void close(void);
+        bool is_open(void) const { return 0 <= this->fDesc; }
+        Format format(void) const { return this->Fmt; }
+        std::size_t bytes_read(void) const { return this->szRead; }
+        InputBuffer();
+        ~InputBuffer();
+
+    protected:
+        virtual int_type underflow(void);
+
+    private:
+        InputBuffer(const InputBuffer &);
+        InputBuffer & operator = (const InputBuffer &);
+        bool fill_raw(void);
+        std::size_t read_raw(char *buf, std::size_t size);
+        bool next_plain(void);
+        bool next_gzip(void);
+        bool next_bgzf(void);
+        bool read_batch(BgzfBatch &batch);
+        void submit_batch(BgzfBatch *batch);
+        void corrupted(const char *reason);
+        int fDesc;
+        bool IsStdin;
+        Format Fmt;
+        std::string FileName;
+        std::vector<char> Raw, Out;
+        std::size_t RawPos, RawEnd, szRead;
+        z_stream_s *Zs;
+        bool IsStreamEnd;
+        ThreadPool *Pool;
+        std::deque<BgzfBatch *> Batches;
+        BgzfBatch *Current;
+    };
+
+    /**
+     * 圧縮（gzip/BGZF）されていても透過的に読めるstd::istream
+     * std::ifstreamの代わりに使う．"-"を指定すると標準入力から読み込む
+     */
+    class InputStream : public std::istream{
+    public:
+        bool open(const char *file, std::size_t threads=0);
+        void close(void);
+        bool is_open(void) const { return this->Buffer.is_open(); }
+        bool is_compressed(void) const { return InputBuffer::PLAIN != this->Buffer.format(); }
+        std::size_t bytes_read(void) const { return this->Buffer.bytes_read(); }
+        InputStream();
+        InputStream(const char *file, std::size_t threads=0);
+
+    private:
+        InputBuffer Buffer;
+    };
+
+    /**
+     * 出力をまとめて書き出すライター（std::ofstream/std::coutの代わりに使う）
+     * 2つの固定長バッファを交互に使い，write()はバックグラウンドのスレッドで行う
+     * 数値はstd::ostreamの既定の書式と同じ表記で文字列化する
+     * "-"を指定すると標準出力に書き出す．exit()する前にclose()を呼ぶこと
+     */
+    class OutputWriter{
+    public:
+        bool open(const char *file);
+        bool close(void);
+        void flush(void);
+        bool fail(void) const { return this->IsFailed; }
+        bool is_open(void) const { return 0 <= this->fDesc; }
+        std::size_t bytes_written(void) const { return this->szWritten + this->Pos; }
+        OutputWriter & write(const char *data, std::size_t size){
+            if(size <= this->Capacity - this->Pos){
+                std::memcpy(this->Front + this->Pos, data, size);
+                this->Pos += size;
+            }
+            else
+                this->write_large(data, size);
+            return *this;
+        }
+        OutputWriter & put(const char chr){
+            if(this->Pos == this->Capacity)
+                this->swap_buffers();
+            this->Front[this->Pos++] = chr;
+            return *this;
+        }
+        OutputWriter & operator << (const char chr){ return this->put(chr); }
+        OutputWriter & operator << (const char *str){ return this->write(str, std::strlen(str)); }
+        OutputWriter & operator << (const std::string &str){ return this->write(str.data(), str.length()); }
+        OutputWriter & operator << (const FieldRef &field){ return this->write(field.ptr, field.len); }
+        OutputWriter & operator << (const int value){ return this->write_signed(value); }
+        OutputWriter & operator << (const long value){ return this->write_signed(value); }
+        OutputWriter & operator << (const long long value){ return this->write_signed(value); }
+        OutputWriter & operator << (const unsigned int value){ return this->write_unsigned(value); }
+        OutputWriter & operator << (const unsigned long value){ return this->write_unsigned(value); }
+        OutputWriter & operator << (const unsigned long long value){ return this->write_unsigned(value); }
+        OutputWriter & operator << (const double value);
+        OutputWriter & operator << (const float value){ return (*this) << (double)value; }
+        OutputWriter();
+        OutputWriter(const char *file);
+        ~OutputWriter();
+
+    private:
+        OutputWriter(const OutputWriter &);
+        OutputWriter & operator = (const OutputWriter &);
+        OutputWriter & write_signed(const long long value);
+        OutputWriter & write_unsigned(unsigned long long value);
+        void write_large(const char *data, std::size_t size);
+        void swap_buffers(void);
+        void work(void);
+        int fDesc;
+        bool IsStdout;
+        char *Front, *Back;
+        std::size_t Capacity, Pos, szBack, szWritten;
+        std::thread Flusher;
+        std::mutex Mutex;
+        std::condition_variable Cond;
+        bool HasBack, IsStopping;
+        std::atomic<bool> IsFailed;
+    };
+
+    /**
+     * メモリ上に出力を溜めるバッファ（OutputWriterと同じ<<で書き込める）
+     * ワーカースレッドがチャンク毎の結果を作り，後で入力順にOutputWriterへ書き出す
+     */
+    class OutputBuffer{
+    public:
+        OutputBuffer & write(const char *data, std::size_t size){
+            this->Data.append(data, size);
+            return *this;
+        }
+        OutputBuffer & put(const char chr){
+            this->Data.push_back(chr);
+            return *this;
+        }
+        OutputBuffer & operator << (const char chr){ return this->put(chr); }
+        OutputBuffer & operator << (const char *str){ return this->write(str, std::strlen(str)); }
+        OutputBuffer & operator << (const std::string &str){ return this->write(str.data(), str.length()); }
+        OutputBuffer & operator << (const FieldRef &field){ return this->write(field.ptr, field.len); }
+        const char * data(void) const { return this->Data.data(); }
+        std::size_t size(void) const { return this->Data.size(); }
+        void clear(void){ this->Data.clear(); }
+
+    private:
+        std::string Data;
+    };
+
+    /**
+     * 処理段階ごとの経過時間・CPU時間と件数を集計する（各ツールの--statsオプション）
+     * 段階は入れ子にでき，時間はその時点で最も内側の段階にのみ加算する
+     * 段階名・カウンタ名は文字列リテラルを渡すこと．無効な間は何もしない
+     */
+    class RunStats{
+    public:
+        void enable(const char *format);
+        void enable_counters(void);
+        bool is_enabled(void) const { return this->IsEnabled; }
+        void enter(const char *phase){
+            if(this->IsTimed)
+                this->enter_phase(phase);
+        }
+        void leave(void){
+            if(this->IsTimed)
+                this->leave_phase();
+        }
+        void count(const char *name, const long long num=1){
+            if(this->IsEnabled)
+                this->add_count(name, num);
+        }
+        void merge(const RunStats &other);
+        long long counter(const char *name) const;
+        void report(const char *program);
+        RunStats();
+
+    private:
+        struct Phase{
+            const char *name;
+            double wall, cpu;
+            long long calls;
+        };
+        struct Counter{
+            const char *name;
+            long long value;
+        };
+        void enter_phase(const char *phase);
+        void leave_phase(void);
+        void add_count(const char *name, const long long num);
+        void accumulate(void);
+        std::vector<Phase> Phases;
+        std::vector<Counter> Counters;
+        SzArray Stack;
+        double StartWall, StartCpu, LastWall, LastCpu;
+        bool IsEnabled, IsTimed, IsJson;
+    };
+
+    // --stats[=json]
+    #define STATS_LONG_OPTION   {"stats", optional_argument, NULL, 'S'}
+
     // functions
     void bad_alloc_exception(const char *function);
-    char * FileRead(const char *file);
+    std::size_t default_threads(void);
     bool split(StringArray &result, const std::string line, const char delimiter);
     bool split(StringArray &result, const char *line, const char *delim);
+    bool next_field(const FieldRef &source, const char delimiter, \
+            std::size_t *pos, FieldRef &result);
+    std::size_t split_int(const FieldRef &source, const char delimiter, \
+            int *values, const std::size_t max_values);
     RETVAL rmspace(char *seq);
     int toupper(char *str);
+    std::size_t clean_upper(const char *src, std::size_t size, char *dest);
+    std::size_t clean_upper(char *seq, std::size_t size);
 }	// End of namespace
 
 //-----------------------------------------------------------------------------
@@ -77,7 +468,8 @@ struct ChromosomeLocation{
         this->length = b.length;
         return *this;
     }
-    friend std::ostream & operator << (std::ostream &ost, const ChromosomeLocation &data){
+    template <typename Ttype>
+    friend Ttype & operator << (Ttype &ost, const ChromosomeLocation &data){
         ost << data.chr << '\t' << data.start << '\t' << data.end << '\t' << data.length;
 		return ost;
 	}
@@ -96,7 +488,8 @@ struct TargetInfo{
         this->dist_end   = b.dist_end;
         return *this;
     }
-    friend std::ostream & operator << (std::ostream &ost, const TargetInfo &data){
+    template <typename Ttype>
+    friend Ttype & operator << (Ttype &ost, const TargetInfo &data){
         ost << data.query << '\t' << data.subject << '\t' << data.dist_start << '\t' << data.dist_end;
 		return ost;
 	}
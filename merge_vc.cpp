@@ -25,15 +25,178 @@
 #include <cstring>
 #include <cstdlib>
 #include <iomanip>
-#include <map>
+#include <unordered_map>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <deque>
+#include <unistd.h>
 
 #define KEY_PROGRAM "#Program"
 #define KEY_LINE    "Line"
 #define KEY_CHR	    "CHROM"
 #define KEY_START   "ChrStart"
 #define KEY_END	    "ChrEnd"
+#define KEY_SUPPORT "Support"
+
+#define RUN_SIZE_MBYTES 256
+#define MAX_MERGE_FAN   64
 //------------------------------------------------------------------------------
-typedef std::map<std::string,std::string> MutationDB;
+/**
+ * 文字列に通し番号を振って1つだけ保持する
+ */
+class StringPool{
+public:
+    uint32_t intern(const hi::FieldRef &str);
+    const std::string & at(uint32_t id) const { return this->Names[id]; }
+    std::size_t size(void) const { return this->Names.size(); }
+
+private:
+    std::unordered_map<std::string,uint32_t> Ids;
+    std::vector<std::string> Names;
+    std::string Buffer;
+};
+
+/**
+ * 固定長のlocusキー
+ * start/endは0以上なら座標値，負なら数値として扱えない文字列の番号（-1-id）
+ */
+struct LocusKey{
+    uint32_t line;
+    uint32_t chr;
+    int32_t start;
+    int32_t end;
+    bool operator==(const LocusKey &right) const {
+        return this->line == right.line && this->chr == right.chr \
+                && this->start == right.start && this->end == right.end;
+    }
+};
+
+/**
+ * locusごとのレコードを保持するオープンアドレス法のハッシュ表
+ * 出力順はcreate_locus_id()の文字列順と同じになるようsorted_order()で並べる
+ */
+class MutationDB{
+public:
+    LocusKey make_key(const hi::FieldRef &line, const hi::FieldRef &chr, \
+            const hi::FieldRef &start, const hi::FieldRef &end);
+    // 新しいlocusならlineを追加してtrue，既存ならprogramだけを記録してfalse
+    bool insert(const LocusKey &key, const std::string &line, const hi::FieldRef &program);
+    std::size_t size(void) const { return this->Entries.size(); }
+    void sorted_order(std::vector<uint32_t> &order) const;
+    void write(std::size_t index, hi::OutputWriter &output, bool withSupport) const;
+    // 別のファイルから作ったotherを読み込み順に追加し，既存だったlocusの数を返す
+    std::size_t absorb(MutationDB &other);
+    // 同じline・染色体で重なるかwindow bp以内のlocusを1つにまとめ，まとめた数を返す
+    std::size_t cluster(int window);
+    MutationDB();
+
+private:
+    struct Entry{
+        LocusKey key;
+        std::string line;                   // 最初のレコード
+        std::vector<uint32_t> programs;     // 見つかった順のプログラム名の番号
+        bool isClustered;                   // 別のlocusの代表にまとめた
+        Entry() : key(), isClustered(false){}
+    };
+    int32_t encode_position(const hi::FieldRef &pos);
+    std::string padded_position(int32_t pos) const;
+    int compare_position(int32_t left, int32_t right, bool isStart) const;
+    std::string locus_id(const LocusKey &key) const;
+    Entry * find(const LocusKey &key, std::size_t &slot);
+    Entry & add(const LocusKey &key, std::size_t slot);
+    void rehash(std::size_t capacity);
+
+    StringPool Lines, Chromosomes, Positions, Programs;
+    std::vector<Entry> Entries;
+    std::vector<uint32_t> Slots;    // Entriesのindex+1，0は空き
+    std::size_t Mask;
+};
+
+struct InputColumns{
+    int program;
+    int line;
+    int chr;
+    int start;
+    int end;
+};
+
+struct MergeSettings{
+    bool isStreaming;           // -s: 外部ソートでマージする
+    bool isSorted;              // -c: 入力はlocus id順に並んでいる
+    std::size_t runBytes;       // 1ランあたりのメモリ上限
+    const char *scratchDir;     // ランを書き出すディレクトリ
+    bool withSupport;           // -u: 支持するプログラム数の列を加える
+    int window;                 // -w: 近いlocusをまとめる距離（負ならまとめない）
+};
+
+/**
+ * ストリーミングモードで扱う1レコード
+ * keyはcreate_locus_id()の文字列，programは重複時に追記するプログラム名
+ */
+struct MergeRecord{
+    std::string key;
+    std::string program;
+    std::string line;
+};
+
+/**
+ * locus id順に並んだレコード列（ランのファイルまたはソート済みの入力ファイル）
+ */
+class RecordSource{
+public:
+    virtual ~RecordSource(){}
+    virtual bool read(MergeRecord &record) = 0;
+    virtual bool fail(void) const { return false; }
+    // ランをまとめた段数（入力ファイルは-1）
+    virtual int level(void) const { return -1; }
+};
+
+/**
+ * 作業ディレクトリに置く一時ファイル．作成直後にunlinkするので後始末は不要
+ */
+class RunFile : public RecordSource{
+public:
+    explicit RunFile(int level=0) : Level(level){}
+    bool create(const char *dir);
+    bool rewind(void);
+    void write(const MergeRecord &record){
+        this->Stream << record.key << '\t' << record.program << '\t' << record.line << '\n';
+    }
+    virtual bool read(MergeRecord &record){
+        return std::getline(this->Stream, record.key, '\t') \
+                && std::getline(this->Stream, record.program, '\t') \
+                && std::getline(this->Stream, record.line);
+    }
+    virtual int level(void) const { return this->Level; }
+
+private:
+    std::fstream Stream;
+    int Level;
+};
+
+/**
+ * -c指定時にランを作らず直接マージする入力ファイル．順序が崩れていればエラー
+ */
+class SortedInput : public RecordSource{
+public:
+    SortedInput(const char *filename, hi::RunStats &stats) \
+            : Filename(filename), Stats(stats), IsFailed(false){}
+    hi::InputStream & stream(void){ return this->File; }
+    void set_columns(const InputColumns &columns){ this->Columns = columns; }
+    virtual bool read(MergeRecord &record);
+    virtual bool fail(void) const { return this->IsFailed; }
+
+private:
+    hi::InputStream File;
+    const char *Filename;
+    InputColumns Columns;
+    hi::RunStats &Stats;
+    hi::FieldView Fields;
+    std::string Line;
+    std::string PrevKey;
+    bool IsFailed;
+};
 //------------------------------------------------------------------------------
 bool determine_position(hi::StringArray &header_elements, \
         const std::string &keyword, int *column_pos){
@@ -50,8 +213,8 @@ bool determine_position(hi::StringArray &header_elements, \
     return false;
 }
 //------------------------------------------------------------------------------
-inline std::string create_locus_id(const std::string &line, \
-        const std::string &chr, const std::string &start, const std::string &end){
+inline std::string create_locus_id(const hi::FieldRef &line, \
+        const hi::FieldRef &chr, const hi::FieldRef &start, const hi::FieldRef &end){
 
     std::stringstream sstr;
     sstr << line << '|' << chr << '_' \
@@ -60,23 +223,365 @@ inline std::string create_locus_id(const std::string &line, \
     return sstr.str();
 }
 //------------------------------------------------------------------------------
-bool read_file(const char *filename, MutationDB &mutationDB, std::string &header_line){
+uint32_t StringPool::intern(const hi::FieldRef &str){
 
-    std::ifstream file(filename, std::ios::in);
-    if(file.fail()){
-    	std::cerr << ERROR_STRING \
-                << "an input file (" << filename \
-                << ") can't open for reading." << ENDL;
-    	return false;
+    str.assign_to(this->Buffer);
+    std::unordered_map<std::string,uint32_t>::iterator iter = this->Ids.find(this->Buffer);
+    if(this->Ids.end() != iter)
+        return iter->second;
+    uint32_t id = this->Names.size();
+    this->Ids.insert(std::make_pair(this->Buffer, id));
+    this->Names.push_back(this->Buffer);
+    return id;
+}
+//------------------------------------------------------------------------------
+/**
+ * 最初のレコードの先頭列の後ろに，2つ目以降のプログラム名を'/'でつないで書き出す
+ * withSupportなら末尾に異なるプログラムの数を加える
+ */
+void write_merged(hi::OutputWriter &output, const std::string &line, \
+        const std::vector<uint32_t> &programs, const StringPool &names, bool withSupport){
+
+    size_t tabPos = (1 < programs.size()) ? line.find('\t') : std::string::npos;
+    if(std::string::npos == tabPos)
+        output << line;
+    else{
+        output.write(line.data(), tabPos);
+        for(size_t i=1; i<programs.size(); i++)
+            output << '/' << names.at(programs[i]);
+        output.write(line.data() + tabPos, line.size() - tabPos);
+    }
+    if(withSupport){
+        std::vector<uint32_t> distinct(programs);
+        std::sort(distinct.begin(), distinct.end());
+        output << '\t' << (std::size_t)(std::unique(distinct.begin(), distinct.end()) - distinct.begin());
+    }
+    output << ENDL;
+}
+//------------------------------------------------------------------------------
+inline uint64_t hash_locus(const LocusKey &key){
+    uint64_t hash = (((uint64_t)key.line << 32) | key.chr) * 0x9e3779b97f4a7c15ULL;
+    hash ^= (((uint64_t)(uint32_t)key.start << 32) | (uint32_t)key.end) * 0xc2b2ae3d27d4eb4fULL;
+    return hash ^ (hash >> 29);
+}
+//------------------------------------------------------------------------------
+MutationDB::MutationDB(){
+    this->rehash(1024);
+}
+//------------------------------------------------------------------------------
+int32_t MutationDB::encode_position(const hi::FieldRef &pos){
+
+    // setw(8)で0埋めした文字列が"%08d"と一致するものだけを数値にする
+    bool isDigits = (pos.size() <= 10);
+    int64_t value = 0;
+    for(size_t i=0; isDigits && i<pos.size(); i++){
+        if('0' > pos[i] || '9' < pos[i])
+            isDigits = false;
+        else
+            value = value * 10 + (pos[i] - '0');
+    }
+    if(isDigits && (pos.size() <= 8 || ('0' != pos[0] && INT32_MAX >= value)))
+        return (int32_t)value;
+    return -1 - (int32_t)this->Positions.intern(pos);
+}
+//------------------------------------------------------------------------------
+LocusKey MutationDB::make_key(const hi::FieldRef &line, const hi::FieldRef &chr, \
+        const hi::FieldRef &start, const hi::FieldRef &end){
+
+    LocusKey key;
+    key.line = this->Lines.intern(line);
+    key.chr = this->Chromosomes.intern(chr);
+    key.start = this->encode_position(start);
+    key.end = this->encode_position(end);
+    return key;
+}
+//------------------------------------------------------------------------------
+void MutationDB::rehash(std::size_t capacity){
+
+    this->Slots.assign(capacity, 0);
+    this->Mask = capacity - 1;
+    for(size_t i=0; i<this->Entries.size(); i++){
+        size_t slot = hash_locus(this->Entries[i].key) & this->Mask;
+        while(0 != this->Slots[slot])
+            slot = (slot + 1) & this->Mask;
+        this->Slots[slot] = i + 1;
+    }
+}
+//------------------------------------------------------------------------------
+MutationDB::Entry * MutationDB::find(const LocusKey &key, std::size_t &slot){
+
+    // 見つからなければslotは追加先の空き
+    slot = hash_locus(key) & this->Mask;
+    while(0 != this->Slots[slot]){
+        Entry &entry = this->Entries[this->Slots[slot] - 1];
+        if(entry.key == key)
+            return &entry;
+        slot = (slot + 1) & this->Mask;
+    }
+    return NULL;
+}
+//------------------------------------------------------------------------------
+MutationDB::Entry & MutationDB::add(const LocusKey &key, std::size_t slot){
+
+    this->Entries.push_back(Entry());
+    this->Entries.back().key = key;
+    this->Slots[slot] = this->Entries.size();
+    // 負荷率を1/2以下に保つ
+    if(this->Slots.size() < 2 * this->Entries.size())
+        this->rehash(2 * this->Slots.size());
+    return this->Entries.back();
+}
+//------------------------------------------------------------------------------
+bool MutationDB::insert(const LocusKey &key, const std::string &line, const hi::FieldRef &program){
+
+    uint32_t programId = this->Programs.intern(program);
+    size_t slot;
+    Entry *entry = this->find(key, slot);
+    if(NULL != entry){
+        entry->programs.push_back(programId);
+        return false;
+    }
+
+    Entry &added = this->add(key, slot);
+    added.line = line;
+    added.programs.push_back(programId);
+    return true;
+}
+//------------------------------------------------------------------------------
+void remap_names(const StringPool &from, StringPool &to, std::vector<uint32_t> &ids){
+    ids.resize(from.size());
+    for(size_t i=0; i<from.size(); i++)
+        ids[i] = to.intern(hi::FieldRef(from.at(i).data(), from.at(i).size()));
+}
+//------------------------------------------------------------------------------
+inline int32_t remap_position(int32_t pos, const std::vector<uint32_t> &ids){
+    return (0 <= pos) ? pos : -1 - (int32_t)ids[-1 - pos];
+}
+//------------------------------------------------------------------------------
+std::size_t MutationDB::absorb(MutationDB &other){
+
+    if(this->Entries.empty()){
+        std::swap(this->Lines, other.Lines);
+        std::swap(this->Chromosomes, other.Chromosomes);
+        std::swap(this->Positions, other.Positions);
+        std::swap(this->Programs, other.Programs);
+        this->Entries.swap(other.Entries);
+        this->Slots.swap(other.Slots);
+        std::swap(this->Mask, other.Mask);
+        return 0;
+    }
+
+    std::vector<uint32_t> lines, chrs, positions, programs;
+    remap_names(other.Lines, this->Lines, lines);
+    remap_names(other.Chromosomes, this->Chromosomes, chrs);
+    remap_names(other.Positions, this->Positions, positions);
+    remap_names(other.Programs, this->Programs, programs);
+
+    // otherのエントリは最初に見つかった順なので，直列に読んだ場合と同じ順に追加される
+    std::size_t num_merged = 0;
+    for(size_t i=0; i<other.Entries.size(); i++){
+        Entry &from = other.Entries[i];
+        LocusKey key;
+        key.line = lines[from.key.line];
+        key.chr = chrs[from.key.chr];
+        key.start = remap_position(from.key.start, positions);
+        key.end = remap_position(from.key.end, positions);
+        for(size_t j=0; j<from.programs.size(); j++)
+            from.programs[j] = programs[from.programs[j]];
+
+        size_t slot;
+        Entry *entry = this->find(key, slot);
+        if(NULL != entry){
+            entry->programs.insert(entry->programs.end(), \
+                    from.programs.begin(), from.programs.end());
+            num_merged++;
+            continue;
+        }
+        Entry &added = this->add(key, slot);
+        added.line.swap(from.line);
+        added.programs.swap(from.programs);
+    }
+    return num_merged;
+}
+//------------------------------------------------------------------------------
+std::size_t MutationDB::cluster(int window){
+
+    // line・染色体・start・end順に並べて走査する（数値でない座標のlocusは対象外）
+    std::vector<uint32_t> order;
+    for(size_t i=0; i<this->Entries.size(); i++){
+        const LocusKey &key = this->Entries[i].key;
+        if(0 <= key.start && 0 <= key.end)
+            order.push_back(i);
+    }
+    const std::vector<Entry> &entries = this->Entries;
+    std::sort(order.begin(), order.end(), [&](uint32_t left, uint32_t right){
+        const LocusKey &a = entries[left].key;
+        const LocusKey &b = entries[right].key;
+        if(a.line != b.line)
+            return a.line < b.line;
+        if(a.chr != b.chr)
+            return a.chr < b.chr;
+        if(a.start != b.start)
+            return a.start < b.start;
+        if(a.end != b.end)
+            return a.end < b.end;
+        return left < right;
+    });
+
+    std::size_t num_clustered = 0;
+    for(size_t begin=0, end; begin<order.size(); begin=end){
+        const LocusKey &first = entries[order[begin]].key;
+        int64_t reach = first.end;
+        size_t representative = begin;
+        for(end=begin+1; end<order.size(); end++){
+            const LocusKey &key = entries[order[end]].key;
+            if(key.line != first.line || key.chr != first.chr \
+                    || (int64_t)key.start > reach + window)
+                break;
+            reach = std::max(reach, (int64_t)key.end);
+            // 最も多くのレコードが支持するlocusを代表にする（同数なら前のもの）
+            if(entries[order[representative]].programs.size() < entries[order[end]].programs.size())
+                representative = end;
+        }
+        if(1 == end - begin)
+            continue;
+
+        // 代表のプログラムの後ろに，残りのlocusのプログラムを座標順に加える
+        Entry &kept = this->Entries[order[representative]];
+        for(size_t i=begin; i<end; i++){
+            if(representative == i)
+                continue;
+            Entry &merged = this->Entries[order[i]];
+            kept.programs.insert(kept.programs.end(), merged.programs.begin(), merged.programs.end());
+            merged.isClustered = true;
+            std::string().swap(merged.line);
+            num_clustered++;
+        }
+    }
+    return num_clustered;
+}
+//------------------------------------------------------------------------------
+void MutationDB::write(std::size_t index, hi::OutputWriter &output, bool withSupport) const{
+    const Entry &entry = this->Entries[index];
+    write_merged(output, entry.line, entry.programs, this->Programs, withSupport);
+}
+//------------------------------------------------------------------------------
+std::string MutationDB::padded_position(int32_t pos) const{
+
+    std::stringstream sstr;
+    sstr << std::setw(8) << std::setfill('0');
+    if(0 <= pos)
+        sstr << pos;
+    else
+        sstr << this->Positions.at(-1 - pos);
+    return sstr.str();
+}
+//------------------------------------------------------------------------------
+inline int padded_digits(int32_t value){
+    int digits = 8;
+    for(int64_t limit=100000000; limit<=value; limit*=10)
+        digits++;
+    return digits;
+}
+//------------------------------------------------------------------------------
+int MutationDB::compare_position(int32_t left, int32_t right, bool isStart) const{
+
+    // 数値同士：0埋めした桁数が同じなら数値の順，違えば長い方の上位桁と比べる
+    // 上位桁が一致すれば短い方が前（後ろの'-'や終端は数字より小さい）
+    if(0 <= left && 0 <= right){
+        int leftDigits = padded_digits(left), rightDigits = padded_digits(right);
+        int64_t a = left, b = right;
+        for(; leftDigits > rightDigits; leftDigits--)
+            a /= 10;
+        for(; rightDigits > leftDigits; rightDigits--)
+            b /= 10;
+        if(a != b)
+            return (a < b) ? -1 : 1;
+        return (left == right) ? 0 : ((left < right) ? -1 : 1);
+    }
+    // それ以外はlocus idと同じく，startなら後ろの'-'まで含めて比べる
+    if(isStart)
+        return (this->padded_position(left) + '-').compare(this->padded_position(right) + '-');
+    return this->padded_position(left).compare(this->padded_position(right));
+}
+//------------------------------------------------------------------------------
+std::string MutationDB::locus_id(const LocusKey &key) const{
+    return this->Lines.at(key.line) + '|' + this->Chromosomes.at(key.chr) + '_' \
+            + this->padded_position(key.start) + '-' + this->padded_position(key.end);
+}
+//------------------------------------------------------------------------------
+inline bool compare_ranked_name(const std::pair<std::string,uint32_t> &left, \
+        const std::pair<std::string,uint32_t> &right){
+    return left.first < right.first;
+}
+//------------------------------------------------------------------------------
+bool rank_names(const StringPool &pool, const char separator, std::vector<uint32_t> &ranks){
+
+    // 区切り文字を付けた名前の順位．どれかが別の名前の接頭辞ならfalse
+    std::vector<std::pair<std::string,uint32_t> > names(pool.size());
+    for(size_t i=0; i<pool.size(); i++)
+        names[i] = std::make_pair(pool.at(i) + separator, (uint32_t)i);
+    std::sort(names.begin(), names.end(), compare_ranked_name);
+
+    bool isPrefixFree = true;
+    ranks.resize(names.size());
+    for(size_t i=0; i<names.size(); i++){
+        ranks[names[i].second] = i;
+        if(0 < i && 0 == names[i].first.compare(0, names[i-1].first.size(), names[i-1].first))
+            isPrefixFree = false;
+    }
+    return isPrefixFree;
+}
+//------------------------------------------------------------------------------
+void MutationDB::sorted_order(std::vector<uint32_t> &order) const{
+
+    // 他のlocusにまとめたものは出力しない
+    order.clear();
+    for(size_t i=0; i<this->Entries.size(); i++){
+        if(! this->Entries[i].isClustered)
+            order.push_back(i);
+    }
+
+    std::vector<uint32_t> lineRanks, chrRanks;
+    bool isPrefixFree = rank_names(this->Lines, '|', lineRanks);
+    isPrefixFree = rank_names(this->Chromosomes, '_', chrRanks) && isPrefixFree;
+    if(! isPrefixFree){
+        // 名前の連結で順序が入れ替わりうるので，locus idの文字列で並べる
+        std::vector<std::pair<std::string,uint32_t> > ids(order.size());
+        for(size_t i=0; i<ids.size(); i++)
+            ids[i] = std::make_pair(this->locus_id(this->Entries[order[i]].key), order[i]);
+        std::sort(ids.begin(), ids.end());
+        for(size_t i=0; i<ids.size(); i++)
+            order[i] = ids[i].second;
+        return;
     }
 
+    const std::vector<Entry> &entries = this->Entries;
+    std::sort(order.begin(), order.end(), [&](uint32_t left, uint32_t right){
+        const LocusKey &a = entries[left].key;
+        const LocusKey &b = entries[right].key;
+        if(a.line != b.line)
+            return lineRanks[a.line] < lineRanks[b.line];
+        if(a.chr != b.chr)
+            return chrRanks[a.chr] < chrRanks[b.chr];
+        if(a.start != b.start)
+            return 0 > this->compare_position(a.start, b.start, true);
+        return 0 > this->compare_position(a.end, b.end, false);
+    });
+}
+//------------------------------------------------------------------------------
+template <typename Toutput>
+bool read_header(hi::InputStream &file, const char *filename, std::string &header_line, \
+        InputColumns &columns, Toutput &output, hi::RunStats &stats){
+
     // header
-    std::cout << "##ORIGINAL_FILE: " << filename << ENDL;
+    stats.enter("header_parse");
+    output << "##ORIGINAL_FILE: " << filename << ENDL;
     while(std::getline(file, header_line)){
         if('#' == header_line[0] && std::string::npos != header_line.find(KEY_CHR))
             break;
         else if('#' == header_line[0]){
-            std::cout << header_line << ENDL;
+            output << header_line << ENDL;
             continue;
         }
     }
@@ -84,61 +589,479 @@ bool read_file(const char *filename, MutationDB &mutationDB, std::string &header
     hi::split(elements, header_line, '\t');
 
     // find column position
-    int pos_program, pos_line, pos_chr, pos_start, pos_end;
-    determine_position(elements, KEY_PROGRAM, &pos_program);
-    determine_position(elements, KEY_LINE, &pos_line);
-    determine_position(elements, KEY_CHR, &pos_chr);
-    determine_position(elements, KEY_START, &pos_start);
-    determine_position(elements, KEY_END, &pos_end);
-    if(0 > pos_program || 0 > pos_line || 0 > pos_chr || 0 > pos_start || 0 > pos_end){
+    determine_position(elements, KEY_PROGRAM, &columns.program);
+    determine_position(elements, KEY_LINE, &columns.line);
+    determine_position(elements, KEY_CHR, &columns.chr);
+    determine_position(elements, KEY_START, &columns.start);
+    determine_position(elements, KEY_END, &columns.end);
+    if(0 > columns.program || 0 > columns.line || 0 > columns.chr \
+            || 0 > columns.start || 0 > columns.end){
     	std::cerr << ERROR_STRING << "1 or more of critical columns can't find." << ENDL;
+        stats.leave();
     	return false;
     }
+    stats.leave();
+    return true;
+}
+//------------------------------------------------------------------------------
+bool open_input(hi::InputStream &file, const char *filename){
 
-    // process records
-    std::string line, locus_id, prev_record;
-    std::stringstream sstr;
-    size_t tabPos;
-    MutationDB::iterator iter;
+    file.open(filename);
+    if(file.fail()){
+    	std::cerr << ERROR_STRING \
+                << "an input file (" << filename \
+                << ") can't open for reading." << ENDL;
+    	return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+void read_records(hi::InputStream &file, const InputColumns &columns, \
+        MutationDB &mutationDB, hi::RunStats &stats){
+
+    std::string line;
+    LocusKey key;
+    hi::FieldView fields;
+    stats.enter("record_parse");
     while(std::getline(file, line)){
-    	elements.clear();
-            hi::split(elements, line, '\t');
-
-    	locus_id = create_locus_id(elements[pos_line], \
-                elements[pos_chr], elements[pos_start], elements[pos_end]);
-    	iter = mutationDB.find(locus_id);
-    	if(mutationDB.end() == iter)
-    	    mutationDB.insert(std::pair<std::string,std::string>(locus_id, line));
+        fields.split(line, '\t');
+        stats.count("records_in");
+
+    	key = mutationDB.make_key(fields[columns.line], \
+                fields[columns.chr], fields[columns.start], fields[columns.end]);
+    	if(! mutationDB.insert(key, line, fields[columns.program]))
+            stats.count("merged_duplicates");
+    }
+    stats.leave();
+
+    file.close();
+    stats.count("bytes_read", file.bytes_read());
+}
+//------------------------------------------------------------------------------
+bool read_file(const char *filename, MutationDB &mutationDB, std::string &header_line, \
+        hi::OutputWriter &output, hi::RunStats &stats){
+
+    hi::InputStream file;
+    InputColumns columns;
+    if(! open_input(file, filename) \
+            || ! read_header(file, filename, header_line, columns, output, stats))
+        return false;
+    read_records(file, columns, mutationDB, stats);
+    return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * -t指定時に1ファイルを読み込むタスク
+ * ヘッダーと結果はここに溜め，メインスレッドがコマンドラインの順に取り込む
+ */
+struct InputTask{
+    const char *filename;
+    bool isOpened;
+    bool isRead;
+    std::string header_line;
+    hi::OutputBuffer header;
+    MutationDB mutationDB;
+    hi::RunStats stats;
+    std::future<void> task;
+};
+
+void read_input_task(InputTask *task){
+
+    hi::InputStream file;
+    InputColumns columns;
+    task->isOpened = open_input(file, task->filename);
+    task->isRead = task->isOpened && read_header(file, task->filename, \
+            task->header_line, columns, task->header, task->stats);
+    if(task->isRead)
+        read_records(file, columns, task->mutationDB, task->stats);
+}
+//------------------------------------------------------------------------------
+bool absorb_input_task(InputTask *task, MutationDB &mutationDB, std::string &header_line, \
+        hi::OutputWriter &output, hi::RunStats &stats){
+
+    stats.enter("reduce");
+    task->task.get();
+    output.write(task->header.data(), task->header.size());
+    if(task->isOpened)
+        header_line.swap(task->header_line);
+    stats.merge(task->stats);
+    if(task->isRead)
+        stats.count("merged_duplicates", mutationDB.absorb(task->mutationDB));
+    stats.leave();
+    return task->isRead;
+}
+//------------------------------------------------------------------------------
+bool RunFile::create(const char *dir){
+
+    std::string path = std::string(dir) + "/merge_vc.XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(&name[0]);
+    if(0 > fd)
+        return false;
+    close(fd);
+    this->Stream.open(&name[0], std::ios::in | std::ios::out | std::ios::trunc);
+    unlink(&name[0]);
+    return this->Stream.is_open();
+}
+//------------------------------------------------------------------------------
+bool RunFile::rewind(void){
+
+    this->Stream.flush();
+    this->Stream.seekg(0);
+    return ! this->Stream.fail();
+}
+//------------------------------------------------------------------------------
+bool SortedInput::read(MergeRecord &record){
+
+    if(! std::getline(this->File, this->Line)){
+        if(this->File.is_open()){
+            this->File.close();
+            this->Stats.count("bytes_read", this->File.bytes_read());
+        }
+        return false;
+    }
+    this->Fields.split(this->Line, '\t');
+    this->Stats.count("records_in");
+
+    record.key = create_locus_id(this->Fields[this->Columns.line], \
+            this->Fields[this->Columns.chr], this->Fields[this->Columns.start], \
+            this->Fields[this->Columns.end]);
+    if(record.key < this->PrevKey){
+        std::cerr << ERROR_STRING << "an input file (" << this->Filename \
+                << ") is not sorted by locus (" << record.key << " after " \
+                << this->PrevKey << ")." << ENDL;
+        this->IsFailed = true;
+        return false;
+    }
+    this->PrevKey = record.key;
+    record.program = this->Fields[this->Columns.program].str();
+    record.line.swap(this->Line);
+    return true;
+}
+//------------------------------------------------------------------------------
+inline bool compare_record_key(const MergeRecord &left, const MergeRecord &right){
+    return left.key < right.key;
+}
+//------------------------------------------------------------------------------
+struct MergeHead{
+    const std::string *key;
+    std::size_t source;
+    bool operator>(const MergeHead &right) const {
+        int cmp = this->key->compare(*right.key);
+        return 0 < cmp || (0 == cmp && this->source > right.source);
+    }
+};
+
+/**
+ * k個のレコード列をヒープでlocus id順にマージする
+ * 同じlocusはsourcesの並び順（=コマンドラインとファイル中の順序）で取り出す
+ * runを指定すると重複をまとめずにランとして書き出し，NULLなら重複をまとめてoutputに出力する
+ */
+bool merge_sources(std::vector<RecordSource*> &sources, RunFile *run, bool withSupport, \
+        hi::OutputWriter *output, hi::RunStats &stats){
+
+    std::vector<MergeRecord> heads(sources.size());
+    std::priority_queue<MergeHead, std::vector<MergeHead>, std::greater<MergeHead> > heap;
+    for(size_t i=0; i<sources.size(); i++){
+        if(sources[i]->read(heads[i])){
+            MergeHead head = {&heads[i].key, i};
+            heap.push(head);
+        }
+        else if(sources[i]->fail())
+            return false;
+    }
+
+    MergeRecord current;
+    StringPool names;
+    std::vector<uint32_t> programs;
+    bool hasCurrent = false;
+    while(! heap.empty()){
+        size_t index = heap.top().source;
+        heap.pop();
+        MergeRecord &record = heads[index];
+
+        if(NULL != run)
+            run->write(record);
+        else if(hasCurrent && current.key == record.key){
+            stats.count("merged_duplicates");
+            programs.push_back(names.intern(hi::FieldRef(record.program.data(), record.program.size())));
+        }
         else{
-            tabPos = iter->second.find('\t');
-            if(std::string::npos == tabPos)
-                continue;
-            sstr.str("");
-            sstr << iter->second.substr(0, tabPos) \
-                    << '/' << elements[pos_program] << iter->second.substr(tabPos);
-            iter->second = sstr.str();
+            if(hasCurrent){
+                write_merged(*output, current.line, programs, names, withSupport);
+                stats.count("records_out");
+            }
+            current.key.swap(record.key);
+            current.line.swap(record.line);
+            programs.assign(1, names.intern(hi::FieldRef(record.program.data(), record.program.size())));
+            hasCurrent = true;
+        }
+
+        if(sources[index]->read(heads[index])){
+            MergeHead head = {&heads[index].key, index};
+            heap.push(head);
+        }
+        else if(sources[index]->fail())
+            return false;
+    }
+    if(hasCurrent){
+        write_merged(*output, current.line, programs, names, withSupport);
+        stats.count("records_out");
+    }
+    return true;
+}
+//------------------------------------------------------------------------------
+void release_sources(std::vector<RecordSource*> &sources, size_t begin, size_t end){
+    for(size_t i=begin; i<end; i++)
+        delete sources[i];
+}
+//------------------------------------------------------------------------------
+bool merge_runs(std::vector<RecordSource*> &sources, size_t begin, size_t end, \
+        const MergeSettings &settings, hi::RunStats &stats){
+
+    // sources[begin, end)を1本のランに置き換える
+    std::vector<RecordSource*> group(sources.begin() + begin, sources.begin() + end);
+    int level = -1;
+    for(size_t i=0; i<group.size(); i++)
+        level = std::max(level, group[i]->level());
+    RunFile *run = new RunFile(level + 1);
+    if(! run->create(settings.scratchDir) \
+            || ! merge_sources(group, run, false, NULL, stats) || ! run->rewind()){
+        std::cerr << ERROR_STRING << "runs can't merge in " \
+                << settings.scratchDir << "." << ENDL;
+        delete run;
+        return false;
+    }
+    release_sources(sources, begin, end);
+    sources.erase(sources.begin() + begin + 1, sources.begin() + end);
+    sources[begin] = run;
+    stats.count("runs_written");
+    return true;
+}
+//------------------------------------------------------------------------------
+bool reduce_sources(std::vector<RecordSource*> &sources, const MergeSettings &settings, \
+        hi::RunStats &stats){
+
+    // 最後のマージで開くランの数を抑えるため，隣り合うランをまとめて1本にする
+    stats.enter("merge");
+    while(MAX_MERGE_FAN < sources.size()){
+        for(size_t begin=0; begin<sources.size(); begin++){
+            size_t end = std::min(begin + MAX_MERGE_FAN, sources.size());
+            if(1 < end - begin && ! merge_runs(sources, begin, end, settings, stats)){
+                stats.leave();
+                return false;
+            }
         }
     }
+    stats.leave();
+    return true;
+}
+//------------------------------------------------------------------------------
+bool write_run(std::vector<MergeRecord> &records, const MergeSettings &settings, \
+        std::vector<RecordSource*> &runs, hi::RunStats &stats){
 
-    file.close();
+    // stable: 同じlocusはファイル中の順序のまま残す
+    std::stable_sort(records.begin(), records.end(), compare_record_key);
+    RunFile *run = new RunFile;
+    if(! run->create(settings.scratchDir)){
+        std::cerr << ERROR_STRING << "a scratch file can't create in " \
+                << settings.scratchDir << "." << ENDL;
+        delete run;
+        return false;
+    }
+    for(size_t i=0; i<records.size(); i++)
+        run->write(records[i]);
+    if(! run->rewind()){
+        std::cerr << ERROR_STRING << "a scratch file can't write in " \
+                << settings.scratchDir << "." << ENDL;
+        delete run;
+        return false;
+    }
+    runs.push_back(run);
+    records.clear();
+    stats.count("runs_written");
+
+    // 同じ段のランがMAX_MERGE_FAN本たまったら1本にまとめ，開いておくランの数を
+    // 段数×MAX_MERGE_FAN本に抑える（末尾ほど段は低いので，両端が同じなら全部同じ段）
+    while(MAX_MERGE_FAN <= runs.size()){
+        size_t begin = runs.size() - MAX_MERGE_FAN;
+        if(runs[begin]->level() != runs.back()->level())
+            break;
+        if(! merge_runs(runs, begin, runs.size(), settings, stats))
+            return false;
+    }
     return true;
 }
 //------------------------------------------------------------------------------
+bool spill_runs(hi::InputStream &file, const InputColumns &columns, \
+        const MergeSettings &settings, std::vector<RecordSource*> &runs, hi::RunStats &stats){
+
+    std::vector<MergeRecord> records;
+    std::size_t bytes = 0;
+    std::string line;
+    hi::FieldView fields;
+    stats.enter("record_parse");
+    while(std::getline(file, line)){
+        fields.split(line, '\t');
+        stats.count("records_in");
+
+        records.push_back(MergeRecord());
+        MergeRecord &record = records.back();
+        record.key = create_locus_id(fields[columns.line], \
+                fields[columns.chr], fields[columns.start], fields[columns.end]);
+        record.program = fields[columns.program].str();
+        record.line.swap(line);
+        bytes += sizeof(MergeRecord) + record.key.capacity() \
+                + record.program.capacity() + record.line.capacity();
+        if(settings.runBytes <= bytes){
+            if(! write_run(records, settings, runs, stats)){
+                stats.leave();
+                return false;
+            }
+            bytes = 0;
+        }
+    }
+    bool isSuccess = records.empty() || write_run(records, settings, runs, stats);
+    stats.leave();
+    return isSuccess;
+}
+//------------------------------------------------------------------------------
+/**
+ * 開けない入力はfalseを返して読み飛ばす
+ * ランの書き出しに失敗した場合は入力の一部だけがsourcesに残るので，isFailedを立てる
+ */
+bool open_stream_file(const char *filename, const MergeSettings &settings, \
+        std::vector<RecordSource*> &sources, std::string &header_line, \
+        hi::OutputWriter &output, hi::RunStats &stats, bool &isFailed){
+
+    InputColumns columns;
+    if(settings.isSorted){
+        SortedInput *input = new SortedInput(filename, stats);
+        if(! open_input(input->stream(), filename) \
+                || ! read_header(input->stream(), filename, header_line, columns, output, stats)){
+            delete input;
+            return false;
+        }
+        input->set_columns(columns);
+        sources.push_back(input);
+        return true;
+    }
+
+    hi::InputStream file;
+    if(! open_input(file, filename) \
+            || ! read_header(file, filename, header_line, columns, output, stats))
+        return false;
+    isFailed = ! spill_runs(file, columns, settings, sources, stats);
+    file.close();
+    stats.count("bytes_read", file.bytes_read());
+    return ! isFailed;
+}
+//------------------------------------------------------------------------------
 int main(int argc, char** argv) {
 
     // parse arguments
-    int nArg=1;
+    int option;
+    int num_threads = 1;
+    hi::RunStats stats;
+    MergeSettings settings = {false, false, \
+            (std::size_t)RUN_SIZE_MBYTES << 20, getenv("TMPDIR"), false, -1};
+    if(NULL == settings.scratchDir || '\0' == settings.scratchDir[0])
+        settings.scratchDir = "/tmp";
+    static const struct option long_options[] = {STATS_LONG_OPTION, {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "scM:T:ut:w:", long_options, NULL)) != -1){
+        switch (option){
+            case 's':
+                settings.isStreaming = true;
+                break;
+            case 'c':
+                settings.isStreaming = true;
+                settings.isSorted = true;
+                break;
+            case 'M':
+                settings.runBytes = (std::size_t)std::max(1, atoi(optarg)) << 20;
+                break;
+            case 'T':
+                settings.scratchDir = optarg;
+                break;
+            case 'u':
+                settings.withSupport = true;
+                break;
+            case 't':
+                num_threads = std::max(1, atoi(optarg));
+                break;
+            case 'w':
+                settings.window = std::max(0, atoi(optarg));
+                break;
+            case 'S':
+                stats.enable(optarg);
+                break;
+        }
+    }
+    int nArg=optind;
     if(argc<=nArg){
-    	std::cerr << USAGE_STRING << argv[0] << " file1 file2 file3..." << ENDL;
+    	std::cerr << USAGE_STRING << argv[0] << " (options) file1 file2 file3..." << ENDL;
+        std::cerr \
+                << " -s  Streaming mode; sort inputs into runs on scratch and merge them [FALSE]" << ENDL \
+                << " -c  Inputs are already sorted by locus (Line, CHROM, ChrStart, ChrEnd);" << ENDL \
+                << "     merge them directly in streaming mode [FALSE]" << ENDL \
+                << " -M  Memory per run in MB for streaming mode [" << RUN_SIZE_MBYTES << "]" << ENDL \
+                << " -T  Scratch directory for streaming mode [$TMPDIR or /tmp]" << ENDL \
+                << " -u  Append a " << KEY_SUPPORT << " column (number of distinct programs) [FALSE]" << ENDL \
+                << " -t  Number of threads to read input files [1]" << ENDL \
+                << " -w  Merge loci of the same line that overlap or lie within N bp," << ENDL \
+                << "     keeping the locus supported by the most records [OFF]" << ENDL \
+                << " --stats[=json]  Report phase timings and counters to stderr" << ENDL;
     	exit(EXIT_FAILURE);
     }
+    if(1 < num_threads && settings.isStreaming){
+        std::cerr << WARNING_STRING << "-t is ignored in streaming mode." << ENDL;
+        num_threads = 1;
+    }
+    if(0 <= settings.window && settings.isStreaming){
+        std::cerr << WARNING_STRING << "-w is ignored in streaming mode." << ENDL;
+        settings.window = -1;
+    }
 
     // create input filelist
     std::stringstream inputstr;
     std::string header_line;
     MutationDB mutationDB;
+    std::vector<RecordSource*> sources;
+    hi::OutputWriter output("-");
+    // files are parsed in parallel into their own databases and
+    // absorbed in the command-line order
+    hi::ThreadPool *pool = (1 < num_threads) \
+            ? new hi::ThreadPool(std::min(num_threads, argc-nArg)) : NULL;
+    std::deque<InputTask *> tasks;
+    size_t next = nArg;
     for(size_t i=nArg; i<argc; i++){
-    	if(! read_file(argv[i], mutationDB, header_line)){
+        bool isRead, isFailed = false;
+        if(settings.isStreaming)
+            isRead = open_stream_file(argv[i], settings, sources, header_line, output, stats, isFailed);
+        else if(NULL == pool)
+            isRead = read_file(argv[i], mutationDB, header_line, output, stats);
+        else{
+            for(; next<(size_t)argc && next<i+2*pool->size(); next++){
+                InputTask *task = new InputTask;
+                task->filename = argv[next];
+                if(stats.is_enabled())
+                    task->stats.enable_counters();
+                task->task = pool->submit(std::bind(read_input_task, task));
+                tasks.push_back(task);
+            }
+            isRead = absorb_input_task(tasks.front(), mutationDB, header_line, output, stats);
+            delete tasks.front();
+            tasks.pop_front();
+        }
+        if(isFailed){
+            std::cerr << ERROR_STRING << "an input file (" << argv[i] \
+                    << ") can't sort into runs. Program execution aborted." << ENDL;
+            release_sources(sources, 0, sources.size());
+            output.close();
+            exit(EXIT_FAILURE);
+        }
+    	if(! isRead){
             std::cerr << WARNING_STRING << "can't open an input file (" \
                     << argv[i] << "). Skipped." << ENDL;
             continue;
@@ -149,17 +1072,50 @@ int main(int argc, char** argv) {
         else
             inputstr << ";input_fn_" << i-nArg+1 << "=" << argv[i];
     }
+    delete pool;
+    if(settings.isStreaming && ! reduce_sources(sources, settings, stats)){
+        output.close();
+        exit(EXIT_FAILURE);
+    }
 
     // header
     std::string cmdstr = generate_cmd_string(argc, argv);
     write_basic_header(__FILE__, __DATE__, __TIME__, \
-            cmdstr.c_str(), inputstr.str().c_str(), std::cout);
-    std::cout << header_line << ENDL;
+            cmdstr.c_str(), inputstr.str().c_str(), output);
+    output << header_line;
+    if(settings.withSupport)
+        output << '\t' << KEY_SUPPORT;
+    output << ENDL;
 
     // output results
-    for(MutationDB::iterator iter=mutationDB.begin(); iter!=mutationDB.end(); iter++)
-	   std::cout << iter->second << ENDL;
+    stats.enter("output");
+    if(settings.isStreaming){
+        bool isMerged = merge_sources(sources, NULL, settings.withSupport, &output, stats);
+        release_sources(sources, 0, sources.size());
+        if(! isMerged){
+            output.close();
+            stats.leave();
+            exit(EXIT_FAILURE);
+        }
+    }
+    else{
+        if(0 <= settings.window)
+            stats.count("clustered_loci", mutationDB.cluster(settings.window));
+        std::vector<uint32_t> order;
+        mutationDB.sorted_order(order);
+        for(size_t i=0; i<order.size(); i++)
+    	   mutationDB.write(order[i], output, settings.withSupport);
+        stats.count("records_out", order.size());
+    }
 
+    if(! output.close()){
+        std::cerr << ERROR_STRING \
+                << "the output can't write. Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    stats.leave();
+    stats.count("bytes_written", output.bytes_written());
+    stats.report("merge_vc");
     exit(EXIT_SUCCESS);
 }
 //------------------------------------------------------------------------------
@@ -30,19 +30,19 @@
 #define POS_INFO_COLUMN         7
 #define SVLEN_FILE_THRESHOLD    100000  // SVLEN >= (value) will be put in x_file
 //------------------------------------------------------------------------------
-int get_svlen(const std::string &infostr){
+int get_svlen(const hi::FieldRef &infostr){
 
-    ssize_t start = infostr.find("SVLEN=");
+    size_t start = infostr.find("SVLEN=");
     if(std::string::npos == start)
         return -1;
-    ssize_t length = infostr.find_first_of(';', start+6) - start -6;
+    size_t length = infostr.find(';', start+6) - start -6;
 
-    return std::abs(std::atoi(infostr.substr(start+6, length).c_str()));
+    return std::abs(infostr.substr(start+6, length).to_int());
 }
 //------------------------------------------------------------------------------
-bool process_vcf(const char *input_fn, const char *o_fn, const char *x_fn){
+bool process_vcf(const char *input_fn, const char *o_fn, const char *x_fn, hi::RunStats &stats){
 
-    std::ifstream file(input_fn, std::ios::in);
+    hi::InputStream file(input_fn);
     if(file.fail()){
         std::cerr << ERROR_STRING << "input file (" \
                 << input_fn << ") open failed." << ENDL;
@@ -50,13 +50,13 @@ bool process_vcf(const char *input_fn, const char *o_fn, const char *x_fn){
     }
 
     // output files
-    std::ofstream o_file(o_fn, std::ios::out);
+    hi::OutputWriter o_file(o_fn);
     if(o_file.fail()){
         std::cerr << ERROR_STRING << "output file (" \
                 << o_fn << ") open failed." << ENDL;
         return false;
     }
-    std::ofstream x_file(x_fn, std::ios::out);
+    hi::OutputWriter x_file(x_fn);
     if(x_file.fail()){
         std::cerr << ERROR_STRING << "large file (" \
                 << x_fn << ") open failed." << ENDL;
@@ -65,18 +65,22 @@ bool process_vcf(const char *input_fn, const char *o_fn, const char *x_fn){
 
     // process file
     std::string line;
-    hi::StringArray elements;
+    hi::FieldView elements;
     bool isAllRefType;
     int sv_length;
+    stats.enter("record_parse");
     while(std::getline(file, line)){
         if('#' == line[0]){
+            stats.enter("header_parse");
             o_file << line << ENDL;
             x_file << line << ENDL;
+            stats.leave();
             continue;
         }
 
-        elements.clear();
-        hi::split(elements, line, '\t');
+        elements.split(line, '\t');
+        stats.count("records_in");
+        stats.enter("filter");
 
         // Skip if all strain has 0/0 genotype
         isAllRefType = true;
@@ -86,8 +90,11 @@ bool process_vcf(const char *input_fn, const char *o_fn, const char *x_fn){
                 break;
             }
         }
-        if(isAllRefType)
+        if(isAllRefType){
+            stats.count("all_ref_genotypes");
+            stats.leave();
             continue;
+        }
 
         sv_length = get_svlen(elements.at(POS_INFO_COLUMN));
         if(0 > sv_length)
@@ -95,23 +102,38 @@ bool process_vcf(const char *input_fn, const char *o_fn, const char *x_fn){
                     elements.at(POS_REF_BASE).length(), \
                     elements.at(POS_ALT_BASE).length());
 
+        stats.leave();
+
+        stats.enter("output");
         if(SVLEN_FILE_THRESHOLD <= sv_length){
             x_file << line << ENDL;
-            continue;
+            stats.count("records_out_large");
         }
-
-        o_file << line << ENDL;
+        else{
+            o_file << line << ENDL;
+            stats.count("records_out");
+        }
+        stats.leave();
     }
+    stats.leave();
 
     file.close();
-    o_file.close();
-    x_file.close();
-    return true;
+    stats.enter("output");
+    const bool isWritten = o_file.close();
+    if(! isWritten)
+        std::cerr << ERROR_STRING << "output file (" << o_fn << ") can't write." << ENDL;
+    const bool isLargeWritten = x_file.close();
+    if(! isLargeWritten)
+        std::cerr << ERROR_STRING << "output file (" << x_fn << ") can't write." << ENDL;
+    stats.leave();
+    stats.count("bytes_read", file.bytes_read());
+    stats.count("bytes_written", o_file.bytes_written() + x_file.bytes_written());
+    return isWritten && isLargeWritten;
 }
 //------------------------------------------------------------------------------
 inline void print_usage(const char *cmd){
     std::cerr << USAGE_STRING << cmd \
-            << " (-t large_threshold) -i [vcf_fn] -o [out_fn] -x [large_fn]" \
+            << " (-t large_threshold) (--stats[=json]) -i [vcf_fn] -o [out_fn] -x [large_fn]" \
             << ENDL;
 }
 //------------------------------------------------------------------------------
@@ -128,7 +150,9 @@ size_t nArg=1;
     std::string i_fn, o_fn, x_fn;
     bool is_i_set=false, is_o_set=false, is_x_set=false;
     int large_threshold=SVLEN_FILE_THRESHOLD;
-    while ((option = getopt(argc, argv, "i:o:x:t:")) != -1){
+    hi::RunStats stats;
+    static const struct option long_options[] = {STATS_LONG_OPTION, {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "i:o:x:t:", long_options, NULL)) != -1){
         switch (option){
             case 'i':
                 i_fn = optarg;
@@ -145,6 +169,9 @@ size_t nArg=1;
             case 't':
                 large_threshold = std::atoi(optarg);
                 break;
+            case 'S':
+                stats.enable(optarg);
+                break;
             default:
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
@@ -154,7 +181,11 @@ size_t nArg=1;
     if(! (is_i_set && is_o_set && is_x_set))
         print_usage(argv[0]);
 
-    process_vcf(i_fn.c_str(), o_fn.c_str(), x_fn.c_str());
+    if(! process_vcf(i_fn.c_str(), o_fn.c_str(), x_fn.c_str(), stats)){
+        std::cerr << ERROR_STRING << "Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    stats.report("pindel_vcf_filter");
 
     exit(EXIT_SUCCESS);
 }
@@ -27,22 +27,26 @@ RETVAL CSeq::open(const char *file){
 	if(this->WFile_use){
 		this->WFile_use = false;
 		this->IsEof		= false;
+		this->IsIndexed	= false;
 		this->NextStart = NULL;
-		delete[] this->WFile;
-		delete[] this->CurrentTitle;
+		this->Current = FastaRecord();
+		this->WFile.close();
+		this->Faidx.clear();
+		this->FaidxNames.clear();
 		delete[] this->CurrentFn;
 	}
 
-	this->WFile = FileRead(file);
-	if(this->WFile==NULL)
-		return RV_TRUE;
+	// the whole file is mapped (not copied) into memory
+	if(! this->WFile.open(file))
+		return RV_FALSE;
 	this->WFile_use = true;
-	this->NextStart = &WFile[0];
+	this->NextStart = this->WFile.data();
 
 	try{
 		std::size_t size=std::strlen(file);
 		this->CurrentFn = new char [size+1];
 		std::memset(this->CurrentFn, '\0', size+1);
+		std::strncpy(this->CurrentFn, file, size);
 	}
 	catch(std::bad_alloc){
 		bad_alloc_exception("CSeq::open()");
@@ -51,18 +55,80 @@ RETVAL CSeq::open(const char *file){
 	return RV_TRUE;
 }
 //-----------------------------------------------------------------------------
+/**
+ * 次のレコードを整形済みの配列として返す
+ * @return 配列（不要になったらdelete[]すること）．レコードが無いか配列が空の場合はNULL
+ */
 char * CSeq::read(void){
 char *seq;
 
-	if(false == this->WFile_use)
+	if(false == this->WFile_use || ! this->next(this->Current))
+		return NULL;
+	if(this->Current.body.empty())
 		return NULL;
 
-	seq = this->fasta_read();
-	clean_seq(seq);
+	try{
+		seq = new char [this->Current.body.length()+1];
+	}
+	catch(std::bad_alloc){
+		return(NULL);
+	}
+	clean_upper(this->Current.body.data(), this->Current.body.length(), seq);
 
 	return seq;
 }
 //-----------------------------------------------------------------------------
+/**
+ * 次のレコードへ進む（ファイルの内容はコピーしない）
+ * @param record タイトル行（先頭の"> "を除く）と配列部分（未整形）への参照
+ * @return レコードがあればtrue
+ */
+bool CSeq::next(FastaRecord &record){
+
+	if(false == this->WFile_use || NULL == this->NextStart)
+		return false;
+
+	const char *tail = this->WFile.data() + this->WFile.size();
+	const char *head = static_cast<const char *>( \
+			std::memchr(this->NextStart, '>', tail - this->NextStart));
+	if(NULL == head){
+		this->NextStart = tail;
+		this->IsEof = true;
+		return false;
+	}
+
+	// 次のレコードの先頭（無ければファイルの終わり）
+	const char *next = static_cast<const char *>(std::memchr(head+1, '>', tail - (head+1)));
+	this->IsEof = (NULL == next);
+	if(NULL == next)
+		next = tail;
+	this->NextStart = next;
+
+	// タイトル行
+	const char *title = head;
+	while(title < next && ('>' == *title || ' ' == *title))
+		++title;
+	const char *body = title;
+	while(body < next && '\r' != *body && '\n' != *body)
+		++body;
+	record.title = FieldRef(title, body - title);
+	record.body  = FieldRef(body, next - body);
+
+	return true;
+}
+//-----------------------------------------------------------------------------
+/**
+ * 配列部分を整形（アルファベット以外の除去，大文字化）してbufferに書き込む
+ * bufferは呼び出し側で使い回せる（最大のレコードの長さまでしか伸びない）
+ * @return 整形後の長さ（buffer[return]は'\0'）
+ */
+std::size_t FastaRecord::clean(std::vector<char> &buffer) const{
+
+	if(buffer.size() < this->body.length()+1)
+		buffer.resize(this->body.length()+1);
+	return clean_upper(this->body.data(), this->body.length(), &buffer[0]);
+}
+//-----------------------------------------------------------------------------
 bool CSeq::eof(void){
 	return this->IsEof;
 }
@@ -70,7 +136,9 @@ bool CSeq::eof(void){
 void CSeq::close(void){
 
 	if(this->WFile_use==true)
-		delete[] this->WFile;
+		this->WFile.close();
+	this->Faidx.clear();
+	this->FaidxNames.clear();
 
 	clear();
 }
@@ -89,71 +157,468 @@ CSeq::~CSeq(){
 }
 //-----------------------------------------------------------------------------
 void CSeq::clear(void){
-	this->NextPos		= 0;
+	this->NextStart		= NULL;
 	this->IsEof			= false;
 	this->WFile_use		= false;
+	this->IsIndexed		= false;
+}
+//-----------------------------------------------------------------------------
+/**
+ * samtools互換の.faiインデックスを用意する
+ * [file].faiがFASTAより新しければ読み込み，そうでなければ作成して書き出す
+ * 以降，fetch()/sequence()はファイル全体を読まずに必要な範囲だけを参照する
+ */
+RETVAL CSeq::index(void){
+
+	if(false == this->WFile_use)
+		return RV_FALSE;
+	if(this->IsIndexed)
+		return RV_TRUE;
+
+	// gzip/BGZF files are decompressed into memory, so the offsets of a .fai
+	// file (which refer to the uncompressed FASTA) are kept in memory only
+	const std::string fai_fn = std::string(this->CurrentFn) + ".fai";
+	const bool useFaiFile = (0 != std::strcmp(this->CurrentFn, "-") \
+			&& ! this->WFile.is_compressed());
+	struct stat fa_st, fai_st;
+	bool isFaiValid = (useFaiFile \
+			&& 0 == stat(this->CurrentFn, &fa_st) && 0 == stat(fai_fn.c_str(), &fai_st) \
+			&& fa_st.st_mtime <= fai_st.st_mtime);
+
+	if(! (isFaiValid && RV_TRUE == this->load_index(fai_fn.c_str()))){
+		if(RV_TRUE != this->build_index())
+			return RV_FALSE;
+		if(useFaiFile && RV_TRUE != this->write_index(fai_fn.c_str())){
+			std::cerr << WARNING_STRING << "the FASTA index (" << fai_fn \
+					<< ") can't be written. Using the index in memory." << ENDL;
+		}
+	}
+
+	this->FaidxNames.clear();
+	for(std::size_t i=0; i<this->Faidx.size(); ++i)
+		this->FaidxNames.insert(std::pair<std::string,std::size_t>(this->Faidx[i].name, i));
+
+	this->WFile.advise(MADV_RANDOM);
+	this->IsIndexed = true;
+	return RV_TRUE;
 }
 //-----------------------------------------------------------------------------
-char * CSeq::fasta_read(void){
-char *sect_head, *sect_body, *sect_seq, *seq;
-std::size_t size, shift;
+RETVAL CSeq::build_index(void){
+
+	const char *buf = this->WFile.data();
+	const long size = this->WFile.size();
+	long pos = 0, lineEnd, szLine, szBases;
+	bool isLastLine = false;
+	FaidxRecord *record = NULL;
+
+	this->Faidx.clear();
+	while(pos < size){
+		const char *hit = static_cast<const char *>(std::memchr(buf+pos, '\n', size-pos));
+		lineEnd = (NULL == hit) ? size : (hit - buf) + 1;
+		szLine = lineEnd - pos;
+		szBases = szLine;
+		if(0 < szBases && '\n' == buf[pos+szBases-1])
+			--szBases;
+		if(0 < szBases && '\r' == buf[pos+szBases-1])
+			--szBases;
 
+		if('>' == buf[pos]){
+			// title line: the name ends at the first white space
+			FaidxRecord newRecord;
+			std::size_t szName = 1;
+			while((long)szName < szBases && 0 == std::isspace(buf[pos+szName]))
+				++szName;
+			newRecord.name.assign(buf+pos+1, szName-1);
+			newRecord.length = newRecord.linebases = newRecord.linewidth = 0;
+			newRecord.offset = lineEnd;
+			this->Faidx.push_back(newRecord);
+			record = &this->Faidx.back();
+			isLastLine = false;
+		}
+		else if(NULL != record && 0 < szBases){
+			if(isLastLine){
+				std::cerr << ERROR_STRING << "different line length in the sequence " \
+						<< record->name << ". The FASTA file can't be indexed." << ENDL;
+				this->Faidx.clear();
+				return RV_FALSE;
+			}
+			if(0 == record->linebases){
+				record->linebases = szBases;
+				record->linewidth = szLine;
+			}
+			else if(szBases != record->linebases || szLine != record->linewidth){
+				if(szBases > record->linebases){
+					std::cerr << ERROR_STRING << "different line length in the sequence " \
+							<< record->name << ". The FASTA file can't be indexed." << ENDL;
+					this->Faidx.clear();
+					return RV_FALSE;
+				}
+				isLastLine = true;
+			}
+			record->length += szBases;
+		}
+		else if(NULL != record)
+			isLastLine = (0 < record->length);
+		pos = lineEnd;
+	}
+
+	return RV_TRUE;
+}
+//-----------------------------------------------------------------------------
+RETVAL CSeq::load_index(const char *fai_fn){
+
+	std::ifstream file(fai_fn, std::ios::in);
+	if(file.fail())
+		return RV_FALSE;
+
+	this->Faidx.clear();
+	std::string line;
+	FieldView fields;
+	FaidxRecord record;
+	while(std::getline(file, line)){
+		if(5 > fields.split(line, '\t')){
+			this->Faidx.clear();
+			return RV_FALSE;
+		}
+		fields[0].assign_to(record.name);
+		record.length    = std::atol(fields[1].str().c_str());
+		record.offset    = std::atol(fields[2].str().c_str());
+		record.linebases = fields[3].to_int();
+		record.linewidth = fields[4].to_int();
+		if(record.offset + record.length > (long)this->WFile.size()){
+			this->Faidx.clear();
+			return RV_FALSE;
+		}
+		this->Faidx.push_back(record);
+	}
+
+	return RV_TRUE;
+}
+//-----------------------------------------------------------------------------
+RETVAL CSeq::write_index(const char *fai_fn){
+
+	std::ofstream file(fai_fn, std::ios::out);
+	if(file.fail())
+		return RV_FALSE;
+
+	for(FaidxRecordArray::const_iterator \
+			record=this->Faidx.begin(); record!=this->Faidx.end(); ++record){
+
+		file << record->name << '\t' << record->length << '\t' << record->offset \
+				<< '\t' << record->linebases << '\t' << record->linewidth << ENDL;
+	}
+
+	file.close();
+	return file.fail() ? RV_FALSE : RV_TRUE;
+}
+//-----------------------------------------------------------------------------
+const FaidxRecord * CSeq::find_index(const std::string &chr){
+
+	if(RV_TRUE != this->index())
+		return NULL;
+
+	FaidxNameMap::const_iterator hit = this->FaidxNames.find(chr);
+	if(this->FaidxNames.end() == hit)
+		return NULL;
+	return &this->Faidx[hit->second];
+}
+//-----------------------------------------------------------------------------
+/**
+ * 配列の一部を切り出す（インデックスを使い，必要な範囲だけを読む）
+ * @param chr   配列名（タイトル行の最初の空白まで）
+ * @param start 開始位置（0から数える）
+ * @param end   終了位置（endを含む）
+ * @return 大文字に変換した配列（長さ end-start+1，配列の範囲外は'\0'）
+ *         配列名が見つからない場合はNULL．不要になったらdelete[]すること
+ */
+char * CSeq::fetch(const std::string &chr, long start, long end){
+
+	const FaidxRecord *record = this->find_index(chr);
+	if(NULL == record || end < start)
+		return NULL;
+
+	char *seq;
+	const long size = end - start + 1;
 	try{
+		seq = new char [size+1];
+		std::memset(seq, '\0', size+1);
+	}
+	catch(std::bad_alloc){
+		return NULL;
+	}
 
-	// ターゲットとなるセットの切り出し
-	sect_head = std::strchr(this->NextStart, '>');
-	if(sect_head=='\0')
-		return(sect_head);
-	size = std::strcspn(sect_head+1, ">");
-	sect_body = new char [size+10];
-	std::memset(sect_body, '\0', size+10);
-	std::strncpy(sect_body, sect_head, size);
-
-	// 次のシークエンスがあるかチェックしてフラグをセット
-	this->NextStart = sect_head+size;
-	if(std::strchr(this->NextStart, '>')==NULL)
-		this->IsEof = true;
-	else
-		this->IsEof = false;
-
-	// タイトル行の抽出
-	size = std::strcspn(sect_body, "\r\n");
-	if(size>0){
-		shift = std::strspn(sect_body, "> ");
-		this->CurrentTitle = new char [size+10];
-		std::memset(this->CurrentTitle, '\0', size+10);
-		std::strncpy(this->CurrentTitle, sect_body+shift, size-shift);
-	}
-	else{
-		size = std::strlen(this->CurrentFn);
-		this->CurrentTitle = new char [size+1];
-		std::memset(this->CurrentTitle, '\0', size+1);
-		std::strcpy(this->CurrentTitle, CurrentFn);
-	}
-
-	// シークエンスの抽出と整形
-	sect_seq = sect_body+size;
-	size = std::strlen(sect_seq);
-	if(size<=0)
-		return(NULL);
+	const char *buf = this->WFile.data();
+	const long first = std::max(start, 0L);
+	const long last  = std::min(end, record->length - 1);
+	long pos = first, szCopy;
+	while(pos <= last){
+		szCopy = std::min(record->linebases - pos % record->linebases, last - pos + 1);
+		std::memcpy(seq + (pos - start), \
+				buf + record->offset + (pos / record->linebases) * record->linewidth \
+					+ pos % record->linebases, szCopy);
+		pos += szCopy;
+	}
+	hi::toupper(seq + std::max(first - start, 0L));
+
+	return seq;
+}
+//-----------------------------------------------------------------------------
+char * CSeq::sequence(const std::string &chr){
+
+	const FaidxRecord *record = this->find_index(chr);
+	if(NULL == record)
+		return NULL;
+	return this->fetch(chr, 0, record->length - 1);
+}
+//-----------------------------------------------------------------------------
+long CSeq::length(const std::string &chr){
 
-	seq = new char [size+1];
-	std::memset(seq, '\0', size+1);
-	std::strncpy(seq, sect_seq, size);
+	const FaidxRecord *record = this->find_index(chr);
+	if(NULL == record)
+		return -1;
+	return record->length;
+}
+//-----------------------------------------------------------------------------
+void CSeq::names(StringArray &result){
+
+	result.clear();
+	if(RV_TRUE != this->index())
+		return;
+	for(FaidxRecordArray::const_iterator \
+			record=this->Faidx.begin(); record!=this->Faidx.end(); ++record)
+		result.push_back(record->name);
+}
+//-----------------------------------------------------------------------------
+/**
+ * 配列を1行ずつ（展開したコピーを作らずに）2bit配列に変換する
+ * @param chr    配列名
+ * @param result 変換結果
+ */
+RETVAL CSeq::pack(const std::string &chr, CPackedSeq &result){
+
+	const FaidxRecord *record = this->find_index(chr);
+	if(NULL == record)
+		return RV_FALSE;
+
+	result.clear();
+	result.reserve(record->length);
+
+	const char *buf = this->WFile.data() + record->offset;
+	long remains = record->length, szLine;
+	while(0 < remains){
+		szLine = std::min(remains, record->linebases);
+		result.append(buf, szLine);
+		buf += record->linewidth;
+		remains -= szLine;
+	}
+	return RV_TRUE;
+}
+//-----------------------------------------------------------------------------
+// CPackedSeq
+//-----------------------------------------------------------------------------
+// 2bit code of each (upper-cased) byte, 0xFF for bases other than A/C/G/T
+struct BaseCodeTable{
+	uint8_t code[256];
+	char upper[256];
+	BaseCodeTable(){
+		for(int i=0; i<256; ++i){
+			upper[i] = ('a'<=i && 'z'>=i) ? i - 0x20 : i;
+			code[i] = 0xFF;
+		}
+		const char *bases = "ACGT";
+		for(int i=0; i<4; ++i){
+			code[(unsigned char)bases[i]] = i;
+			code[(unsigned char)bases[i] + 0x20] = i;
+		}
+	}
+};
+static const BaseCodeTable BaseCodes;
+static const char *PackedBases = "ACGT";
+//-----------------------------------------------------------------------------
+CPackedSeq::CPackedSeq(){
+	this->Length = 0;
+}
+//-----------------------------------------------------------------------------
+void CPackedSeq::clear(void){
+	this->Words.clear();
+	this->Runs.clear();
+	this->Length = 0;
+}
+//-----------------------------------------------------------------------------
+void CPackedSeq::reserve(long length){
+	this->Words.reserve(length / 32 + 1);
+}
+//-----------------------------------------------------------------------------
+void CPackedSeq::append(const char *bases, std::size_t size){
+
+	uint8_t code;
+	for(std::size_t i=0; i<size; ++i, ++this->Length){
+		if(0 == (this->Length & 31))
+			this->Words.push_back(0);
+
+		code = BaseCodes.code[(unsigned char)bases[i]];
+		if(0xFF == code){
+			// extend the last run, or start a new one
+			const char base = BaseCodes.upper[(unsigned char)bases[i]];
+			if(! this->Runs.empty() && base == this->Runs.back().base \
+					&& this->Runs.back().start + this->Runs.back().length == this->Length)
+				++this->Runs.back().length;
+			else{
+				BaseRun run;
+				run.start  = this->Length;
+				run.length = 1;
+				run.base   = base;
+				this->Runs.push_back(run);
+			}
+			continue;
+		}
+		this->Words.back() |= (uint64_t)code << ((this->Length & 31) * 2);
+	}
+}
+//-----------------------------------------------------------------------------
+char CPackedSeq::base(long pos) const{
+
+	if(0 > pos || pos >= this->Length)
+		return '\0';
+
+	// runs are sorted by their start positions
+	BaseRunArray::const_iterator run = this->Runs.end();
+	long lo = 0, hi = this->Runs.size();
+	while(lo < hi){
+		const long mid = (lo + hi) / 2;
+		if(this->Runs[mid].start <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(0 < lo){
+		run = this->Runs.begin() + (lo - 1);
+		if(pos < run->start + run->length)
+			return run->base;
+	}
+
+	return PackedBases[(this->Words[pos >> 5] >> ((pos & 31) * 2)) & 3];
+}
+//-----------------------------------------------------------------------------
+/**
+ * 配列の一部を展開する（CSeq::fetch()と同じ規則）
+ * @param start 開始位置（0から数える）
+ * @param end   終了位置（endを含む）
+ * @return 長さ end-start+1 の配列（範囲外は'\0'）．不要になったらdelete[]すること
+ */
+char * CPackedSeq::fetch(long start, long end) const{
+
+	if(end < start)
+		return NULL;
+
+	char *seq;
+	const long size = end - start + 1;
+	try{
+		seq = new char [size+1];
+		std::memset(seq, '\0', size+1);
 	}
 	catch(std::bad_alloc){
-		return(NULL);
+		return NULL;
+	}
+
+	const long first = std::max(start, 0L);
+	const long last  = std::min(end, this->Length - 1);
+	if(first > last)
+		return seq;
+
+	// decode the 2bit words
+	char *out = seq + (first - start);
+	uint64_t word = this->Words[first >> 5] >> ((first & 31) * 2);
+	for(long pos=first; pos<=last; ++pos){
+		if(0 == (pos & 31))
+			word = this->Words[pos >> 5];
+		*out++ = PackedBases[word & 3];
+		word >>= 2;
+	}
+
+	// overwrite N/IUPAC runs overlapping with the region
+	long lo = 0, hi = this->Runs.size();
+	while(lo < hi){
+		const long mid = (lo + hi) / 2;
+		if(this->Runs[mid].start + this->Runs[mid].length <= first)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for(BaseRunArray::const_iterator run=this->Runs.begin()+lo; \
+			run!=this->Runs.end() && run->start<=last; ++run){
+
+		const long runStart = std::max(run->start, first);
+		const long runEnd   = std::min(run->start + run->length - 1, last);
+		std::memset(seq + (runStart - start), run->base, runEnd - runStart + 1);
+	}
+
+	return seq;
+}
+//-----------------------------------------------------------------------------
+std::size_t CPackedSeq::memory_size(void) const{
+	return this->Words.capacity() * sizeof(uint64_t) \
+			+ this->Runs.capacity() * sizeof(BaseRun);
+}
+//-----------------------------------------------------------------------------
+// CPackedGenome
+//-----------------------------------------------------------------------------
+RETVAL CPackedGenome::load(const char *file){
+
+	CSeq fasta;
+	if(RV_TRUE != fasta.open(file) || RV_TRUE != fasta.index())
+		return RV_FALSE;
+
+	StringArray chrNames;
+	fasta.names(chrNames);
+	this->Seqs.clear();
+	for(StringArray::const_iterator name=chrNames.begin(); name!=chrNames.end(); ++name){
+		if(RV_TRUE != fasta.pack(*name, this->Seqs[*name]))
+			return RV_FALSE;
 	}
 
-	return(seq);
+	fasta.close();
+	return RV_TRUE;
+}
+//-----------------------------------------------------------------------------
+char * CPackedGenome::fetch(const std::string &chr, long start, long end){
+
+	PackedSeqMap::const_iterator hit = this->Seqs.find(chr);
+	if(this->Seqs.end() == hit)
+		return NULL;
+	return hit->second.fetch(start, end);
+}
+//-----------------------------------------------------------------------------
+char * CPackedGenome::sequence(const std::string &chr){
+
+	PackedSeqMap::const_iterator hit = this->Seqs.find(chr);
+	if(this->Seqs.end() == hit)
+		return NULL;
+	return hit->second.fetch(0, hit->second.length() - 1);
+}
+//-----------------------------------------------------------------------------
+long CPackedGenome::length(const std::string &chr){
+
+	PackedSeqMap::const_iterator hit = this->Seqs.find(chr);
+	if(this->Seqs.end() == hit)
+		return -1;
+	return hit->second.length();
+}
+//-----------------------------------------------------------------------------
+std::size_t CPackedGenome::memory_size(void) const{
+
+	std::size_t size = 0;
+	for(PackedSeqMap::const_iterator seq=this->Seqs.begin(); seq!=this->Seqs.end(); ++seq)
+		size += seq->second.memory_size();
+	return size;
 }
 //-----------------------------------------------------------------------------
 RETVAL clean_seq(char *buffer){
-	RETVAL ret = hi::rmspace(buffer);
-	if(RV_TRUE != ret)
-		return ret;
-	hi::toupper(buffer);
-	return ret;
+	const std::size_t size = std::strlen(buffer);
+	if(0 == size)
+		return RV_FALSE;
+	hi::clean_upper(buffer, size);
+	return RV_TRUE;
 }
 //-----------------------------------------------------------------------------
 
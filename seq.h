@@ -24,32 +24,111 @@
 #include <string>
 #include <cstring>
 #include <vector>
+#include <map>
+#include <fstream>
 
 namespace HI_NAMESPACE{
 
+	// samtools互換の.faiインデックスの1行分
+	struct FaidxRecord{
+		std::string name;
+		long length, offset, linebases, linewidth;
+	};
+	typedef std::vector<FaidxRecord> FaidxRecordArray;
+	typedef std::map<std::string, std::size_t> FaidxNameMap;
+
+	// A/C/G/T以外の塩基（N, IUPAC等）の連続領域
+	struct BaseRun{
+		long start, length;
+		char base;
+	};
+	typedef std::vector<BaseRun> BaseRunArray;
+
+	/**
+	 * 1塩基2bitで保持する配列（A=0, C=1, G=2, T=3）
+	 * A/C/G/T以外の塩基はBaseRunの一覧として別に保持する
+	 */
+	class CPackedSeq{
+	public:
+		void clear(void);
+		void reserve(long length);
+		void append(const char *bases, std::size_t size);
+		char base(long pos) const;
+		char * fetch(long start, long end) const;
+		long length(void) const { return this->Length; }
+		std::size_t memory_size(void) const;
+		CPackedSeq();
+
+	private:
+		std::vector<uint64_t> Words;
+		BaseRunArray Runs;
+		long Length;
+	};
+	typedef std::map<std::string, CPackedSeq> PackedSeqMap;
+
+	/**
+	 * FASTAの1レコード（タイトルと配列はマップしたファイルへの参照で，コピーしない）
+	 * 配列の整形は必要になった時にclean()で行う
+	 */
+	struct FastaRecord{
+		FieldRef title;
+		FieldRef body;
+		std::size_t clean(std::vector<char> &buffer) const;
+	};
+
 	class CSeq{
 	public:
 		RETVAL open(const char *file);
 		char * read(void);
+		bool next(FastaRecord &record);
+		const FieldRef & title(void) const { return this->Current.title; }
 		bool eof(void);
 		void close(void);
+		RETVAL index(void);
+		char * fetch(const std::string &chr, long start, long end);
+		char * sequence(const std::string &chr);
+		long length(const std::string &chr);
+		void names(StringArray &result);
+		RETVAL pack(const std::string &chr, CPackedSeq &result);
 		CSeq();
 		CSeq(const char *file);
 		~CSeq();
 
 	private:
-		char *fasta_read(void);
 		void clear(void);
-		char *WFile;
-		char *NextStart;
-		char *CurrentTitle;
+		RETVAL build_index(void);
+		RETVAL load_index(const char *fai_fn);
+		RETVAL write_index(const char *fai_fn);
+		const FaidxRecord * find_index(const std::string &chr);
+		FaidxRecordArray Faidx;
+		FaidxNameMap FaidxNames;
+		bool IsIndexed;
+		MappedFile WFile;
+		const char *NextStart;
+		FastaRecord Current;
 		char *CurrentFn;
-		size_t NextPos;
 		bool IsEof;
 		bool WFile_use;
 		RETVAL Warning;
 	};
 
+	/**
+	 * 2bit配列の集合（配列名で参照する）
+	 * fetch()/sequence()/length()はCSeqと同じ結果を返す
+	 */
+	class CPackedGenome{
+	public:
+		RETVAL load(const char *file);
+		char * fetch(const std::string &chr, long start, long end);
+		char * sequence(const std::string &chr);
+		long length(const std::string &chr);
+		std::size_t memory_size(void) const;
+		void clear(void){ this->Seqs.clear(); }
+
+	private:
+		PackedSeqMap Seqs;
+	};
+
 	RETVAL clean_seq(char *buffer);
 }	// End of namespace
 
@@ -36,13 +36,22 @@
 typedef std::map<std::string,std::string> AnnotationDB;
 typedef std::map<std::string,std::string> KeyValueDB;
 typedef std::map<std::string,int> SampleOrderMap;
-typedef std::vector<KeyValueDB> KeyValueDBArray;
-typedef std::vector<hi::StringArray> StringArrayArray;
 typedef std::vector<int> IntArray;
 typedef std::map<std::string,std::string> MutEffectDB;
 typedef std::map<int,std::string> GenotypeBaseMap;
 typedef std::set<std::string> StringSet;
 //------------------------------------------------------------------------------
+/**
+ * 1サンプル分のFORMATデータ
+ * GT/AD/DPは書き換えるため文字列として保持し，それ以外は行バッファを参照する
+ */
+struct SampleData{
+    hi::FieldView fields;
+    std::string GT, AD, DP;
+    bool hasGT, hasAD, hasDP;
+};
+typedef std::vector<SampleData> SampleDataArray;
+//------------------------------------------------------------------------------
 inline bool get_record_as_string(const KeyValueDB &inputDB, const char *keyname, \
         std::string &result){
 
@@ -94,7 +103,7 @@ bool parse_annotation(const std::string &line, KeyValueDB &result){
 //------------------------------------------------------------------------------
 bool load_annotations_from_gff(const char *gff_fn, AnnotationDB &annots){
 
-    std::ifstream infile(gff_fn, std::ios::in);
+    hi::InputStream infile(gff_fn);
     if(infile.fail()){
         std::cerr << ERROR_STRING << "the specified GFF file (" << gff_fn \
                 << ") can't open for reading." << ENDL;
@@ -143,34 +152,64 @@ bool load_annotations_from_gff(const char *gff_fn, AnnotationDB &annots){
     return true;
 }
 // -----------------------------------------------------------------------------
-bool parse_info_field(const std::string &line, KeyValueDB &result){
-
-    hi::StringArray values, arr;
-    if(! hi::split(values, line, ';'))
-        return false;
-
-    std::string key, value;
-    ssize_t sep;
-    for(hi::StringArray::iterator iter=values.begin(); iter!=values.end(); ++iter){
-        sep = iter->find('=');
+inline bool get_info_value(const hi::FieldRef &info, const char *keyname, \
+        hi::FieldRef &result){
+
+    // the first "key=value" (or a bare "key") in the INFO field wins
+    std::size_t pos=0, sep;
+    hi::FieldRef item;
+    while(hi::next_field(info, ';', &pos, item)){
+        sep = item.find('=');
         if(std::string::npos == sep){
-            result.insert(std::pair<std::string,std::string>(*iter, *iter));
+            if(item == keyname){
+                result = item;
+                return true;
+            }
             continue;
         }
-        key = iter->substr(0, sep);
-        value = iter->substr(sep+1);
-        result.insert(std::pair<std::string,std::string>(key, value));
+        if(item.substr(0, sep) == keyname){
+            result = item.substr(sep+1);
+            return true;
+        }
+    }
+
+    return false;
+}
+// -----------------------------------------------------------------------------
+inline bool get_info_as_string(const hi::FieldRef &info, const char *keyname, \
+        std::string &result){
+
+    hi::FieldRef value;
+    if(get_info_value(info, keyname, value))
+        value.assign_to(result);
+    else{
+        result = ".";
+        return false;
+    }
+
+    return true;
+}
+// -----------------------------------------------------------------------------
+inline bool get_info_as_int(const hi::FieldRef &info, const char *keyname, \
+        int *result){
+
+    hi::FieldRef value;
+    if(get_info_value(info, keyname, value))
+        *result = value.to_int();
+    else{
+        *result = -1;
+        return false;
     }
 
     return true;
 }
 //------------------------------------------------------------------------------
 inline void write_output_header(const char *filename, const hi::StringArray &names, \
-        const hi::StringArray &columns, const char *cmdstr, std::ostream &ofs){
+        const hi::StringArray &columns, const char *cmdstr, hi::OutputWriter &ofs){
 
     std::stringstream inputstr;
     inputstr << "input_fn=" << filename;
-    write_basic_header(__FILE__, __DATE__, __TIME__, cmdstr, inputstr.str().c_str(), std::cout);
+    write_basic_header(__FILE__, __DATE__, __TIME__, cmdstr, inputstr.str().c_str(), ofs);
     ofs << "#CHROM" \
         << "\tChrStart" << "\tChrEnd" << "\tReference" << "\tAlternatives" \
         << "\tQuality" << "\tFilter" << "\tInfo" << "\tType" << "\tEffect" << "\tGene" \
@@ -184,67 +223,72 @@ inline void write_output_header(const char *filename, const hi::StringArray &nam
     ofs << "\tLink" << ENDL;
 }
 //------------------------------------------------------------------------------
-inline std::string remove_string(const std::string &input, \
-        const char *word, const int szWord){
+inline void remove_string(std::string &target, const char *word, const int szWord){
 
-    std::string target = input;
-    ssize_t hit = target.find(word);
+    size_t hit = target.find(word);
     while(std::string::npos != hit){
-        target.replace(hit, szWord, "");
+        target.erase(hit, szWord);
         hit = target.find(word);
     }
-
-    return target;
 }
 //------------------------------------------------------------------------------
-bool process_ann_field(const std::string &ann_string, \
-        std::string &mut_effect, hi::StringArray &mut_genes){
+bool process_ann_field(const hi::FieldRef &ann_string, \
+        std::string &mut_effect, std::string &geneid, hi::StringArray &mut_genes){
 
-    hi::StringArray blocks;
-    hi::split(blocks, ann_string, ',');
-    if(1 > blocks.size())
+    // Only use the first hit
+    std::size_t pos=0;
+    hi::FieldRef target;
+    if(! hi::next_field(ann_string, ',', &pos, target))
         return false;
 
-    hi::StringArray items, parts;
-    std::string geneid;
-    for(hi::StringArray::iterator target=blocks.begin(); target!=blocks.end(); ++target){
-        items.clear();
-        hi::split(items, *target, '|');
+    hi::FieldRef item, effect, gene;
+    std::size_t num_items=0;
+    pos = 0;
+    while(hi::next_field(target, '|', &pos, item)){
+        if(1 == num_items)
+            effect = item;
+        else if(3 == num_items)
+            gene = item;
+        ++num_items;
+    }
 
-        // effect
-		if(1 < items.size() && "" != items[1])
-            mut_effect = items[1];
-        else{
-	    	mut_effect = ".";
-            return true;
-	    }
+    // effect
+    if(1 < num_items && ! effect.empty())
+        effect.assign_to(mut_effect);
+    else{
+        mut_effect = ".";
+        return true;
+    }
 
-        // mutated genes
-		if(3 < items.size() && "" != items[3]){
-			geneid = items[3];
-        	geneid = remove_string(geneid, "LOC_", 4);
-        	geneid = remove_string(geneid, "Gene_", 5);
-        }
-        else{
-        	geneid = ".";
-            break;
-        }
+    // mutated genes
+    if(3 < num_items && ! gene.empty()){
+        gene.assign_to(geneid);
+        remove_string(geneid, "LOC_", 4);
+        remove_string(geneid, "Gene_", 5);
+    }
+    else{
+        geneid = ".";
+        return true;
+    }
 
-        parts.clear();
-        hi::split(parts, geneid, '-');
-        if(4 < parts[0].length() && 't' == parts[0][4] && "Os" == parts[0].substr(0, 2))
-            parts[0][4] = 'g';
-        mut_genes.push_back(parts[0]);
+    hi::FieldRef first, last, part;
+    std::size_t num_parts=0;
+    pos = 0;
+    while(hi::next_field(hi::FieldRef(geneid.c_str(), geneid.length()), '-', &pos, part)){
+        if(0 == num_parts)
+            first = part;
+        last = part;
+        ++num_parts;
+    }
 
-        if(1 < parts.size() && 4 < parts[parts.size()-1].length() && \
-                't' == parts[parts.size()-1][4] & "Os" == parts[parts.size()-1].substr(0, 2)){
-            parts[parts.size()-1][4] = 'g';
-            mut_genes.push_back(parts[parts.size()-1]);
-        }
+    mut_genes.push_back(first.str());
+    if(4 < first.length() && 't' == first[4] && first.starts_with("Os"))
+        mut_genes.back()[4] = 'g';
 
-        // Only use the first hit -- use for() loop for future extension
-        if(target==blocks.begin())
-            break;
+    if(1 < num_parts && 4 < last.length() && \
+            't' == last[4] && last.starts_with("Os")){
+        mut_genes.push_back(last.str());
+        mut_genes.back()[4] = 'g';
     }
 
     return true;
@@ -306,12 +350,12 @@ bool create_genotype_base_map(const std::string &refString, const std::string &a
     return true;
 }
 //------------------------------------------------------------------------------
-inline void correct_mutation_type(const std::string &ref, const std::string &alt, \
+inline void correct_mutation_type(const hi::FieldRef &ref, const hi::FieldRef &alt, \
         std::string &mut_type){
 
     if(1==ref.length() && 1==alt.length())
         mut_type = "SNV";
-    else if(std::string::npos != alt.find(",") || std::string::npos != ref.find(","))
+    else if(std::string::npos != alt.find(',') || std::string::npos != ref.find(','))
         mut_type = "MULTI_ALLELIC";
     else if(ref.length() > alt.length())
         mut_type = "DEL";
@@ -321,16 +365,18 @@ inline void correct_mutation_type(const std::string &ref, const std::string &alt
         mut_type = "DEL+INS";
 }
 //------------------------------------------------------------------------------
-inline void correct_mutation_length(const std::string &ref, const std::string &alt, \
+inline void correct_mutation_length(const hi::FieldRef &ref, const hi::FieldRef &alt, \
         int *mut_length){
 
-    if(std::string::npos != alt.find(",") || std::string::npos != ref.find(",")){
-        hi::StringArray elements;
-        hi::split(elements, alt, ',');
-        hi::split(elements, ref, ',');
+    if(std::string::npos != alt.find(',') || std::string::npos != ref.find(',')){
         int maxLength = 0;
-        for(hi::StringArray::iterator iter=elements.begin(); iter!=elements.end(); ++iter)
-            maxLength = std::max(maxLength, std::atoi(iter->c_str()));
+        std::size_t pos=0;
+        hi::FieldRef element;
+        while(hi::next_field(alt, ',', &pos, element))
+            maxLength = std::max(maxLength, element.to_int());
+        pos = 0;
+        while(hi::next_field(ref, ',', &pos, element))
+            maxLength = std::max(maxLength, element.to_int());
         *mut_length = maxLength;
     }
     else
@@ -360,225 +406,223 @@ inline void generate_annotation_string(const AnnotationDB &annotDB, \
     get_annotation(annotDB, gidstr, funcstr);
 
     if(2 <= mut_genes.size()){
-        const std::string mutgene2 = mut_genes.at(mut_genes.size()-1);
-        std::stringstream sstr;
-        sstr << gidstr << " // " << mutgene2;
-        gidstr = sstr.str();
+        const std::string &mutgene2 = mut_genes.at(mut_genes.size()-1);
+        gidstr.append(" // ").append(mutgene2);
+
+        AnnotationDB::const_iterator hit = annotDB.find(mutgene2);
+        funcstr.append(" // ").append(annotDB.end()!=hit ? hit->second : ".");
+    }
+}
+//------------------------------------------------------------------------------
+inline int find_format_key(const hi::FieldView &format, const char *keyname){
 
-        std::string func2;
-        get_annotation(annotDB, mutgene2, func2);
-        sstr.str("");
-        sstr << funcstr << " // " << func2;
-        funcstr = sstr.str();
+    for(std::size_t i=0; i<format.size(); ++i){
+        if(format[i] == keyname)
+            return i;
     }
+    return -1;
+}
+//------------------------------------------------------------------------------
+inline bool get_sample_field(const SampleData &DB, const hi::FieldView &format, \
+        const int index, hi::FieldRef &result){
+
+    // keys without a matching value in the sample are treated as missing
+    if(0 > index || (std::size_t)index >= std::min(format.size(), DB.fields.size()))
+        return false;
+    result = DB.fields[index];
+    return true;
 }
 //------------------------------------------------------------------------------
-inline void fetch_user_defined_datasets(const KeyValueDBArray &allSampleData, \
-        const hi::StringArray &columnsToWrite, StringArrayArray &result){
-
-    hi::StringArray dataset;
-    KeyValueDB::const_iterator iter;
-    for(KeyValueDBArray::const_iterator DB=allSampleData.begin(); DB!=allSampleData.end(); ++DB){
-        dataset.clear();
-        for(hi::StringArray::const_iterator key=columnsToWrite.begin(); key!=columnsToWrite.end(); ++key){
-            iter = DB->find(*key);
-            if(DB->end() != iter)
-                dataset.push_back(iter->second);
+inline void write_user_defined_datasets(const SampleDataArray &allSampleData, \
+        const std::size_t numSamples, const hi::FieldView &format, \
+        const hi::StringArray &columnsToWrite, const IntArray &columnIndex, \
+        hi::OutputWriter &ofs){
+
+    hi::FieldRef value;
+    for(std::size_t i=0; i<columnsToWrite.size(); ++i){
+        const std::string &key = columnsToWrite[i];
+        for(std::size_t k=0; k<numSamples; ++k){
+            const SampleData &DB = allSampleData[k];
+            if("GT" == key && DB.hasGT)
+                ofs << '\t' << DB.GT;
+            else if("AD" == key && DB.hasAD)
+                ofs << '\t' << DB.AD;
+            else if("DP" == key && DB.hasDP)
+                ofs << '\t' << DB.DP;
+            else if("GT" != key && "AD" != key && "DP" != key \
+                    && get_sample_field(DB, format, columnIndex[i], value))
+                ofs << '\t' << value;
             else
-                dataset.push_back(".");
+                ofs << "\t.";
         }
-        result.push_back(dataset);
     }
 }
 //------------------------------------------------------------------------------
-inline void modify_GT(KeyValueDB &DB){
+inline void modify_GT(SampleData &DB){
 
     // Switch
     bool isUseAD = true;
 
     // Retrive records
-    KeyValueDB::iterator iterGT = DB.find("GT");
-    if(DB.end() == iterGT)
+    if(! DB.hasGT)
         return;
-    KeyValueDB::iterator iterAD = DB.find("AD");
-    if(DB.end() == iterAD)
+    if(! DB.hasAD)
         isUseAD = false;
 
-    // Parse AD items
-    hi::StringArray ad_items;
-    if(isUseAD)
-        hi::split(ad_items, iterAD->second, ',');
+    // Parse AD items (only the first two are used)
+    hi::FieldRef ad_items[2];
+    std::size_t num_ad_items=0, pos=0;
+    hi::FieldRef item;
+    if(isUseAD){
+        while(hi::next_field(hi::FieldRef(DB.AD.c_str(), DB.AD.length()), ',', &pos, item)){
+            if(2 > num_ad_items)
+                ad_items[num_ad_items] = item;
+            ++num_ad_items;
+        }
+    }
 
     // Replace
-    size_t hit = iterGT->second.find("/");
-    while(std::string::npos != hit){
-        iterGT->second.replace(hit, 1, "|");
-        hit = iterGT->second.find("/");
-    }
+    std::replace(DB.GT.begin(), DB.GT.end(), '/', '|');
 
     // Correct genotypes
-    if(".|." == iterGT->second){
-        iterGT->second = ".";
+    if(".|." == DB.GT){
+        DB.GT = ".";
         if(isUseAD){
-            ad_items.clear();
-            for(int i=0; i<2; ++i)
-                ad_items.push_back(".");
+            ad_items[0] = ad_items[1] = hi::FieldRef(".", 1);
+            num_ad_items = 2;
         }
     }
-    else if("1|." == iterGT->second){
-        iterGT->second = ".";
+    else if("1|." == DB.GT){
+        DB.GT = ".";
         if(isUseAD){
-            const std::string adstr = ad_items.at(0);
-            ad_items.clear();
-            ad_items.push_back(".");
-            ad_items.push_back(adstr);
+            ad_items[1] = ad_items[0];
+            ad_items[0] = hi::FieldRef(".", 1);
+            num_ad_items = 2;
         }
     }
 
     // Genotype should be homozygous if the other AD is zero
-    if(isUseAD && 2<=ad_items.size()){
-        if("0"==ad_items.at(0) && "0"!=ad_items.at(1))
-            iterGT->second = "1|1";
-        else if("0"==ad_items.at(1) && "0"!=ad_items.at(0))
-            iterGT->second = "0|0";
+    if(isUseAD && 2<=num_ad_items){
+        if("0"==ad_items[0] && "0"!=ad_items[1])
+            DB.GT = "1|1";
+        else if("0"==ad_items[1] && "0"!=ad_items[0])
+            DB.GT = "0|0";
     }
 
     return;
 }
 //------------------------------------------------------------------------------
-inline void correct_pindel_AD_format(KeyValueDB &DB, std::string &record){
+inline void correct_pindel_AD_format(SampleData &DB, std::string &record){
     // Assume the record has single number in AD
-    std::stringstream sstr;
-    KeyValueDB::iterator gt = DB.find("GT");
-    if(DB.end() == gt)
+    if(! DB.hasGT)
         return;
 
-    if("0|0" == gt->second || "0/0" == gt->second){
-        sstr << record << "|0";
-        record = sstr.str();
-    }
-    else if("1|1" == gt->second || "1/1" == gt->second){
-        sstr << "0|" << record;
-        record = sstr.str();
-    }
-    else if("1|." == gt->second){
-        gt->second = ".";
-        sstr << ".|" << record;
-        record = sstr.str();
+    if("0|0" == DB.GT || "0/0" == DB.GT)
+        record.append("|0");
+    else if("1|1" == DB.GT || "1/1" == DB.GT)
+        record.insert(0, "0|");
+    else if("1|." == DB.GT){
+        DB.GT = ".";
+        record.insert(0, ".|");
     }
 
     return;
 }
 //------------------------------------------------------------------------------
-inline void modify_AD(KeyValueDB &DB){
+inline void modify_AD(SampleData &DB){
 
-    KeyValueDB::iterator ad = DB.find("AD");
-    if(DB.end() == ad)
+    if(! DB.hasAD)
         return;
 
     // genotype should always be ".(undetermined)" when DP == "."
-    KeyValueDB::iterator dp = DB.find("DP");
-    if(DB.end() != dp  &&  "." == dp->second){
-        ad->second = ".";
+    if(DB.hasDP  &&  "." == DB.DP){
+        DB.AD = ".";
         return;
     }
 
-    ssize_t hit = ad->second.find(",");
-    if(std::string::npos == hit){
-        correct_pindel_AD_format(DB, ad->second);
+    if(std::string::npos == DB.AD.find(',')){
+        correct_pindel_AD_format(DB, DB.AD);
         return;
     }
 
-    while(std::string::npos != hit){
-        ad->second.replace(hit, 1, "|");
-        hit = ad->second.find(",");
-    }
+    std::replace(DB.AD.begin(), DB.AD.end(), ',', '|');
     return;
 }
 //------------------------------------------------------------------------------
-inline void interpolate_DP(KeyValueDB &DB){
+inline void interpolate_DP(SampleData &DB){
 
     // do nothing if DP is already in the record
-    KeyValueDB::iterator iter = DB.find("DP");
-    if(DB.end() != iter)
+    if(DB.hasDP)
         return;
 
     // interpolate DP from AD (if avairable)
-    iter = DB.find("AD");
-    if(DB.end() == iter)
+    if(! DB.hasAD)
         return;
 
-    hi::StringArray items;
-    hi::split(items, iter->second, '|');
-
+    std::size_t pos=0;
+    hi::FieldRef item;
     int totalDepth = 0;
-    for(hi::StringArray::iterator item=items.begin(); item!=items.end(); ++item)
-        totalDepth += std::atoi(item->c_str());
+    while(hi::next_field(hi::FieldRef(DB.AD.c_str(), DB.AD.length()), '|', &pos, item))
+        totalDepth += item.to_int();
 
-    std::stringstream depthstr;
-    depthstr << totalDepth;
-    DB.insert(std::pair<std::string,std::string>("DP", depthstr.str()));
+    char depthstr[16];
+    std::snprintf(depthstr, sizeof(depthstr), "%d", totalDepth);
+    DB.DP = depthstr;
+    DB.hasDP = true;
     return;
 }
 //------------------------------------------------------------------------------
-inline void modify_data(KeyValueDBArray &allSampleData){
-    for(KeyValueDBArray::iterator DB=allSampleData.begin(); DB!=allSampleData.end(); ++DB){
+inline void modify_data(SampleDataArray &allSampleData, const std::size_t numSamples){
+    for(std::size_t k=0; k<numSamples; ++k){
         // DO NOT change the order!!
-        modify_GT(*DB);
-        modify_AD(*DB);
-        interpolate_DP(*DB);
+        modify_GT(allSampleData[k]);
+        modify_AD(allSampleData[k]);
+        interpolate_DP(allSampleData[k]);
     }
 }
 //------------------------------------------------------------------------------
-bool parse_sample_fields(const hi::StringArray &items, const IntArray &sampleOrder, \
-        KeyValueDBArray &result){
+bool parse_sample_fields(const hi::FieldView &items, const IntArray &sampleOrder, \
+        hi::FieldView &format, SampleDataArray &result){
 
     // parse FORMAT field
-    hi::StringArray format;
-    hi::split(format, items.at(8), ':');
+    format.split(items.at(8), ':');
     if(0 >= format.size())
         return false;
 
-    hi::StringArray elements;
-    KeyValueDB DB;
-    int minItems;
-    for(IntArray::const_iterator column=sampleOrder.begin(); column!=sampleOrder.end(); ++column){
-        elements.clear();
-        hi::split(elements, items.at(*column), ':');
-/*
-        if(format.size() != elements.size()){
-            std::cerr << WARNING_STRING << "invalid data structure:" \
-                << " the number of elements differ between FORMAT and SAMPLE fields." \
-                << ENDL;
-        }
-*/
-        DB.clear();
-        minItems = std::min(format.size(), elements.size());
-        for(int k=0; k<minItems; ++k)
-            DB.insert(std::pair<std::string,std::string>(format.at(k), elements.at(k)));
-        result.push_back(DB);
+    const int posGT = find_format_key(format, "GT");
+    const int posAD = find_format_key(format, "AD");
+    const int posDP = find_format_key(format, "DP");
+
+    if(result.size() < sampleOrder.size())
+        result.resize(sampleOrder.size());
+
+    hi::FieldRef value;
+    for(std::size_t k=0; k<sampleOrder.size(); ++k){
+        SampleData &DB = result[k];
+        DB.fields.split(items.at(sampleOrder[k]), ':');
+
+        DB.hasGT = get_sample_field(DB, format, posGT, value);
+        if(DB.hasGT)
+            value.assign_to(DB.GT);
+        DB.hasAD = get_sample_field(DB, format, posAD, value);
+        if(DB.hasAD)
+            value.assign_to(DB.AD);
+        DB.hasDP = get_sample_field(DB, format, posDP, value);
+        if(DB.hasDP)
+            value.assign_to(DB.DP);
     }
     return true;
 }
 //------------------------------------------------------------------------------
-int get_min_fields(const StringArrayArray &input){
-
-    int minFields = input.at(0).size();
-    for(int i=1; i<input.size(); ++i)
-        minFields = std::min(minFields, (int)input.at(i).size());
-    return minFields;
-}
-//------------------------------------------------------------------------------
 inline void trim_sequence(std::string &seq, const int *szFlanking){
     const size_t szSeq = seq.length();
     if((2 * (*szFlanking)) >= szSeq)
         return;
 
-    std::stringstream sstr;
-    sstr << seq.substr(0, *szFlanking) \
-            << " ...(" << szSeq - (2 * (*szFlanking)) << " bp)... " \
-            << seq.substr(szSeq-(*szFlanking));
-    seq = sstr.str();
+    char label[48];
+    std::snprintf(label, sizeof(label), \
+            " ...(%lu bp)... ", (unsigned long)(szSeq - (2 * (*szFlanking))));
+    seq.replace(*szFlanking, szSeq - (2 * (*szFlanking)), label);
 }
 //------------------------------------------------------------------------------
 inline void trim_annotation(std::string &Line, const char *Key){
@@ -614,30 +658,36 @@ void create_sample_order_array(const hi::StringArray &samples, \
 //------------------------------------------------------------------------------
 bool process_vcf(const char *filename, const hi::StringArray &samples, \
         const hi::StringArray &columnsToWrite, const AnnotationDB &annotDB, \
-        const int *szFlanking, const char *cmdstr){
+        const int *szFlanking, const char *cmdstr, hi::RunStats &stats){
 
-    std::ifstream infile(filename, std::ios::in);
+    stats.enter("header_parse");
+    hi::InputStream infile(filename);
     if(infile.fail()){
         std::cerr << ERROR_STRING << "input file (" << filename << ") open failed." << ENDL;
         return false;
     }
 
     // process file
-    IntArray sampleOrder;
-    std::string line, chrName, ann, mut_type, mut_effect, mut_geneid, mut_genefunc;
+    IntArray sampleOrder, columnIndex(columnsToWrite.size());
+    std::string line, mut_type, mut_effect, mut_geneid, mut_genefunc;
+    std::string geneid, refstr, altstr, infostr;
     int mut_length, startPosition, endPosition;
-    hi::StringArray items, mut_genes;
-    KeyValueDB infoDB;
-    KeyValueDBArray allSampleData;
-    StringArrayArray dataToWrite;
+    hi::StringArray mut_genes;
+    hi::FieldView items, format;
+    hi::FieldRef chrName, info, ann;
+    SampleDataArray allSampleData;
 
     // write header
-    write_output_header(filename, samples, columnsToWrite, cmdstr, std::cout);
+    hi::OutputWriter output("-");
+    write_output_header(filename, samples, columnsToWrite, cmdstr, output);
+    stats.leave();
 
+    stats.enter("record_parse");
     while(std::getline(infile, line)){
-        if("##" == line.substr(0, 2))
+        if(0 == line.compare(0, 2, "##"))
             continue;
-        else if("#CHROM" == line.substr(0, 6)){
+        else if(0 == line.compare(0, 6, "#CHROM")){
+            stats.enter("header_parse");
             hi::StringArray elements;
             hi::split(elements, line, '\t');
             if(9 > elements.size()){
@@ -655,78 +705,104 @@ bool process_vcf(const char *filename, const hi::StringArray &samples, \
                     sampleOrder.at(pos) = i;
                 }
             }
+            stats.leave();
             continue;
         }
-        items.clear();
-        hi::split(items, line, '\t');
+        items.split(line, '\t');
+        stats.count("records_in");
         if(7 > items.size()){
             std::cerr << WARNING_STRING << ENDL;
+            stats.count("skipped_short_records");
             continue;
         }
 
-        // parse INFO field
-        infoDB.clear();
-        parse_info_field(items[7], infoDB);
+        // INFO field
+        info = items[7];
 
         // SVTYPE & SVLEN
-        get_record_as_string(infoDB, "SVTYPE", mut_type);
+        get_info_as_string(info, "SVTYPE", mut_type);
         if("." == mut_type)
             correct_mutation_type(items[3], items[4], mut_type);
-        get_record_as_int(infoDB, "SVLEN", &mut_length);
+        get_info_as_int(info, "SVLEN", &mut_length);
         if(0 > mut_length)
             correct_mutation_length(items[3], items[4], &mut_length);
 
         // Location
         chrName = items[0];
-        startPosition = std::atoi(items[1].c_str());
+        startPosition = items[1].to_int();
         endPosition = startPosition + std::abs(mut_length);
 
         // ANN
+        stats.enter("annotate");
         mut_genes.clear();
         mut_effect = ".";
-        if(get_record_as_string(infoDB, "ANN", ann))
-            process_ann_field(ann, mut_effect, mut_genes);
+        if(get_info_value(info, "ANN", ann))
+            process_ann_field(ann, mut_effect, geneid, mut_genes);
 
         // REF/ALT sequences
-        trim_sequence(items[3], szFlanking);
-        trim_sequence(items[4], szFlanking);
+        items[3].assign_to(refstr);
+        items[4].assign_to(altstr);
+        trim_sequence(refstr, szFlanking);
+        trim_sequence(altstr, szFlanking);
 
         // Remove some features from INFO
-        trim_annotation(items[7], "ANN");
-        trim_annotation(items[7], "LOF");
+        info.assign_to(infostr);
+        trim_annotation(infostr, "ANN");
+        trim_annotation(infostr, "LOF");
+        stats.leave();
 
         // Output
         // CHROM, StartPos, EndPos, REF, ALT, QUAL, FILTER, INFO, Type, Effect
-        std::cout << chrName << '\t' << startPosition << '\t' << endPosition \
-                << '\t' << items[3] << '\t' << items[4] << '\t' << items[5] \
-                << '\t' << items[6] << '\t' << items[7] << '\t' << mut_type \
+        stats.enter("output");
+        output << chrName << '\t' << startPosition << '\t' << endPosition \
+                << '\t' << refstr << '\t' << altstr << '\t' << items[5] \
+                << '\t' << items[6] << '\t' << infostr << '\t' << mut_type \
                 << '\t' << mut_effect;
 
+        stats.leave();
+
         // Gene & Annotation
+        stats.enter("annotate");
         generate_annotation_string(annotDB, mut_genes, mut_geneid, mut_genefunc);
-        std::cout << '\t' << mut_geneid << '\t' << mut_genefunc;
-
-        // Create FORMAT->DATA map from each sample
-        allSampleData.clear();
-        parse_sample_fields(items, sampleOrder, allSampleData);
-        modify_data(allSampleData);
-
-        // Extract user-defined datasets
-        dataToWrite.clear();
-        fetch_user_defined_datasets(allSampleData, columnsToWrite, dataToWrite);
-        for(int i=0; i<get_min_fields(dataToWrite); ++i){
-            for(StringArrayArray::const_iterator fields=dataToWrite.begin(); fields!=dataToWrite.end(); ++fields)
-                std::cout << '\t' << fields->at(i);
+        stats.leave();
+        stats.enter("output");
+        output << '\t' << mut_geneid << '\t' << mut_genefunc;
+        stats.leave();
+
+        // Parse FORMAT & DATA fields of each sample
+        stats.enter("annotate");
+        if(parse_sample_fields(items, sampleOrder, format, allSampleData)){
+            modify_data(allSampleData, sampleOrder.size());
+
+            // Write user-defined datasets
+            for(std::size_t i=0; i<columnsToWrite.size(); ++i)
+                columnIndex[i] = find_format_key(format, columnsToWrite[i].c_str());
+            stats.enter("output");
+            write_user_defined_datasets(allSampleData, sampleOrder.size(), \
+                    format, columnsToWrite, columnIndex, output);
+            stats.leave();
         }
+        stats.leave();
 
         // Link
-        std::cout << '\t' << "=HYPERLINK(\"http://localhost:60151/goto?locus=" \
+        stats.enter("output");
+        output << '\t' << "=HYPERLINK(\"http://localhost:60151/goto?locus=" \
             << chrName << ':' << startPosition << '-' << endPosition \
             << "\", \"link\")" << ENDL;
+        stats.count("records_out");
+        stats.leave();
     }
+    stats.leave();
 
     infile.close();
-    return true;
+    stats.enter("output");
+    const bool isWritten = output.close();
+    if(! isWritten)
+        std::cerr << ERROR_STRING << "the output can't write." << ENDL;
+    stats.leave();
+    stats.count("bytes_read", infile.bytes_read());
+    stats.count("bytes_written", output.bytes_written());
+    return isWritten;
 }
 //------------------------------------------------------------------------------
 inline void print_usage(const char *cmd){
@@ -734,13 +810,13 @@ inline void print_usage(const char *cmd){
     std::cerr << cmd \
             << " -i (vcf_fn) -a (annotation_gff) " \
             << " -c (column_to_export) -s (sz_flanking_to_show)" \
-            << " [sample names]" << ENDL;
+            << " (--stats[=json]) [sample names]" << ENDL;
     std::cerr << ENDL;
 }
 // -----------------------------------------------------------------------------
 bool determine_sample_names(const char *vcf_fn, hi::StringArray &names){
 
-    std::ifstream infile(vcf_fn, std::ios::in);
+    hi::InputStream infile(vcf_fn);
     if(infile.fail()){
         std::cerr << ERROR_STRING << "input file (" << vcf_fn << ") open failed." << ENDL;
         return false;
@@ -779,7 +855,9 @@ int main(int argc, char *argv[]){
     // parse arguments
     char option;
     int szFlanking=VCF2XLS_SZ_FLANKS_SHOW;
-    while ((option = getopt(argc, argv, "i:a:c:s:")) != -1){
+    hi::RunStats stats;
+    static const struct option long_options[] = {STATS_LONG_OPTION, {NULL, 0, NULL, 0}};
+    while ((option = getopt_long(argc, argv, "i:a:c:s:", long_options, NULL)) != -1){
         switch (option){
             case 'i':
                 vcf_fn = optarg;
@@ -793,6 +871,9 @@ int main(int argc, char *argv[]){
             case 's':
                 szFlanking = std::atoi(optarg);
                 break;
+            case 'S':
+                stats.enable(optarg);
+                break;
             default:
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
@@ -843,12 +924,18 @@ int main(int argc, char *argv[]){
 
     // load annotatinos from GFF
     AnnotationDB annots;
+    stats.enter("annotation_load");
     if("" != gff_fn)
         load_annotations_from_gff(gff_fn.c_str(), annots);
+    stats.leave();
 
     // process file
     std::string cmdstr = generate_cmd_string(argc, argv);
-    process_vcf(vcf_fn.c_str(), names, columns, annots, &szFlanking, cmdstr.c_str());
+    if(! process_vcf(vcf_fn.c_str(), names, columns, annots, &szFlanking, cmdstr.c_str(), stats)){
+        std::cerr << ERROR_STRING << "Program execution aborted." << ENDL;
+        exit(EXIT_FAILURE);
+    }
+    stats.report("vcf2xls");
 
     exit(EXIT_SUCCESS);
 }